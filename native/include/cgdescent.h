@@ -0,0 +1,150 @@
+/**
+ * @file cgdescent.h
+ * @author Jupiter Westbard
+ * @date 10/18/2026
+ * @brief fixed-size gradient descent for 3 parameter circle fits
+ */
+
+#include <cmath>
+#include <limits>
+
+#include <Eigen/Core>
+
+#ifndef CGDESCENT_H
+#define CGDESCENT_H
+
+/**
+ * Same iteration as gdc::GradientDescent<Scalar, Objective, BarzilaiBorwein>
+ * (direct BB steps, central differences, no momentum), but every vector is an
+ * Eigen::Matrix<Scalar, 3, 1> and the objective and callback are called
+ * directly instead of through std::function. Nothing in minimize touches the
+ * heap, and constructing one costs a handful of scalar stores.
+ *
+ * Objective: Scalar operator()(const Vector &xval, Vector &gradient) const,
+ *            gdcpp style. Leaving the gradient untouched is fine, it is
+ *            computed by central differences unless setAnalyticGradient(true)
+ *            says the objective fills it in.
+ * Callback:  bool operator()(long iteration, const Vector &xval, Scalar fval,
+ *            const Vector &gradient); returning false stops the descent.
+ */
+template<typename Scalar>
+struct CircleNoCallback {
+    typedef Eigen::Matrix<Scalar, 3, 1> Vector;
+
+    bool operator()(long, const Vector &, Scalar, const Vector &) const {
+        return true;
+    }
+};
+
+template<typename Scalar, typename Objective, typename Callback = CircleNoCallback<Scalar>>
+class CircleDescent {
+public:
+    typedef Eigen::Matrix<Scalar, 3, 1> Vector;
+
+    struct Result {
+        long iterations;
+        bool converged;
+        Scalar fval;
+        Vector xval;
+    };
+
+    CircleDescent()
+        : maxIt_(0), minGradientLen_(static_cast<Scalar>(1e-9)),
+          minStepLen_(static_cast<Scalar>(1e-9)), constStep_(static_cast<Scalar>(1e-4)),
+          maxStepLen_(0), eps_(defaultEpsilon()), analytic_(false), objective_(), callback_() { }
+
+    void setMaxIterations(long iterations) { maxIt_ = iterations; }
+    void setMinGradientLength(Scalar len) { minGradientLen_ = len; }
+    void setMinStepLength(Scalar len) { minStepLen_ = len; }
+    void setConstStepSize(Scalar step) { constStep_ = step; }
+    void setMaxStepLength(Scalar len) { maxStepLen_ = len; } // <= 0: unbounded
+    void setNumericalEpsilon(Scalar eps) { eps_ = eps; }
+    void setAnalyticGradient(bool analytic) { analytic_ = analytic; }
+    void setObjective(const Objective &objective) { objective_ = objective; }
+    void setCallback(const Callback &callback) { callback_ = callback; }
+
+    Result minimize(const Vector &initialGuess) {
+        Vector xval = initialGuess;
+        Vector gradient = Vector::Zero();
+        Vector step = Vector::Zero();
+        Vector lastXval = Vector::Zero();
+        Vector lastGradient = Vector::Zero();
+        Scalar fval = 0;
+        Scalar gradientLen = minGradientLen_ + 1;
+        Scalar stepLen = minStepLen_ + 1;
+        bool callbackResult = true;
+
+        long iterations = 0;
+        while ((maxIt_ <= 0 || iterations < maxIt_) &&
+               gradientLen >= minGradientLen_ &&
+               stepLen >= minStepLen_ &&
+               callbackResult) {
+            xval -= step;
+            fval = evaluate(xval, gradient);
+            gradientLen = gradient.norm();
+
+            // direct Barzilai-Borwein step, constant on the first iteration
+            Scalar stepSize = constStep_;
+            if (iterations > 0) {
+                Vector sk = xval - lastXval;
+                Vector yk = gradient - lastGradient;
+                Scalar denom = sk.dot(yk);
+                stepSize = denom == 0 ? Scalar(1) : std::abs(sk.dot(sk) / denom);
+            }
+            lastXval = xval;
+            lastGradient = gradient;
+
+            step = stepSize * gradient;
+            stepLen = step.norm();
+            if (maxStepLen_ > 0 && stepLen > maxStepLen_) {
+                step *= maxStepLen_ / stepLen;
+                stepLen = maxStepLen_;
+            }
+            callbackResult = callback_(iterations, xval, fval, gradient);
+            ++iterations;
+        }
+
+        Result result;
+        result.iterations = iterations;
+        result.converged = gradientLen < minGradientLen_ || stepLen < minStepLen_;
+        result.fval = fval;
+        result.xval = xval;
+        return result;
+    }
+
+private:
+    long maxIt_;
+    Scalar minGradientLen_;
+    Scalar minStepLen_;
+    Scalar constStep_;
+    Scalar maxStepLen_;
+    Scalar eps_;
+    bool analytic_;
+    Objective objective_;
+    Callback callback_;
+
+    // gdcpp's default for double; float can't resolve sqrt(eps) steps on
+    // coordinates in the hundreds, so it differentiates over a hundredth of a pixel
+    static Scalar defaultEpsilon() {
+        if (std::numeric_limits<Scalar>::digits < 53) return static_cast<Scalar>(1e-2);
+        return std::sqrt(std::numeric_limits<Scalar>::epsilon());
+    }
+
+    Scalar evaluate(const Vector &xval, Vector &gradient) {
+        if (analytic_) return objective_(xval, gradient);
+
+        Vector unused;
+        Scalar fval = objective_(xval, unused);
+        for (int i = 0; i < 3; ++i) {
+            Vector xvalN = xval;
+            xvalN(i) += eps_ / 2;
+            Scalar fwd = objective_(xvalN, unused);
+            xvalN(i) = xval(i) - eps_ / 2;
+            Scalar bwd = objective_(xvalN, unused);
+            gradient(i) = (fwd - bwd) / eps_;
+        }
+        return fval;
+    }
+};
+
+#endif
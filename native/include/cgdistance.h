@@ -0,0 +1,111 @@
+/**
+ * @file cgdistance.h
+ * @author Jupiter Westbard
+ * @date 10/18/2026
+ * @brief distance transform circle objective
+ */
+
+#include <cmath>
+#include <algorithm>
+
+#include "circlegen.h"
+
+#ifndef CGDISTANCE_H
+#define CGDISTANCE_H
+
+/**
+ * Scores a circle by the edge distance at samples spaced along its
+ * circumference, so one evaluation costs O(perimeter) lookups no matter how
+ * many edge pixels there are:
+ *
+ *   f = mean_k min(D(p_k), band) + (minRadius - r)^2 if r < minRadius
+ *
+ * D is sampled bilinearly and the gradient comes out in closed form: the
+ * center moves with every sample, and r moves each sample along its normal.
+ * Samples off the map or beyond the band contribute the band and no gradient.
+ * Without the penalty a tiny circle sitting on a single edge pixel would win.
+ */
+struct DistanceOptimization {
+    static thread_local const ddistmap *map;  // held by the fit running on this thread
+    static thread_local long evaluations;
+    static thread_local long samples;   // distance lookups
+    static thread_local long inside;    // lookups of the last evaluation within the band
+
+    double band = CG_LOSS_BAND;
+    double spacing = 2.0;
+    double minRadius = 10.0;
+
+    template<typename Vector>
+    typename Vector::Scalar operator()(const Vector &params, Vector &gradient) const {
+        typedef typename Vector::Scalar Scalar;
+
+        double cx = params(0);
+        double cy = params(1);
+        double r = params(2);
+        int count = (int)std::ceil(2.0 * M_PI * std::abs(r) / spacing);
+        count = std::max(16, std::min(1024, count));
+
+        // walk the circumference by rotating (ct, st) instead of calling cos/sin per sample
+        double rot_c = std::cos(2.0 * M_PI / count);
+        double rot_s = std::sin(2.0 * M_PI / count);
+        double ct = 1.0, st = 0.0;
+
+        double total = 0.0;
+        double gx = 0.0, gy = 0.0, gr = 0.0;
+        long hits = 0;
+        for (int k = 0; k < count; ++k, rotate(ct, st, rot_c, rot_s)) {
+            double x = cx + r * ct;
+            double y = cy + r * st;
+            if (!(x >= 0 && y >= 0 && x < map->width - 1 && y < map->height - 1)) {
+                total += band;
+                continue;
+            }
+
+            int x0 = (int)x;
+            int y0 = (int)y;
+            double fx = x - x0;
+            double fy = y - y0;
+            const float *row = &map->dist[y0 * map->width + x0];
+            double d00 = row[0], d10 = row[1];
+            double d01 = row[map->width], d11 = row[map->width + 1];
+            double d = (1 - fy) * ((1 - fx) * d00 + fx * d10) + fy * ((1 - fx) * d01 + fx * d11);
+            if (d >= band) {
+                total += band;
+                continue;
+            }
+
+            double ddx = (1 - fy) * (d10 - d00) + fy * (d11 - d01);
+            double ddy = (1 - fx) * (d01 - d00) + fx * (d11 - d10);
+            total += d;
+            gx += ddx;
+            gy += ddy;
+            gr += ddx * ct + ddy * st;
+            ++hits;
+        }
+
+        double fval = total / count;
+        gx /= count;
+        gy /= count;
+        gr /= count;
+        if (r < minRadius) {
+            fval += (minRadius - r) * (minRadius - r);
+            gr -= 2.0 * (minRadius - r);
+        }
+
+        ++evaluations;
+        samples += count;
+        inside = hits;
+        gradient(0) = (Scalar)gx;
+        gradient(1) = (Scalar)gy;
+        gradient(2) = (Scalar)gr;
+        return (Scalar)fval;
+    }
+
+    static void rotate(double &c, double &s, double rot_c, double rot_s) {
+        double next_c = c * rot_c - s * rot_s;
+        s = s * rot_c + c * rot_s;
+        c = next_c;
+    }
+};
+
+#endif
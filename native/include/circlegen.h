@@ -7,6 +7,13 @@
 
 #include <tuple>
 #include <vector>
+#include <cstddef>
+#include <random>
+#include <memory>
+#include <unordered_map>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 
 #ifndef CIRCLEGEN_H
 #define CIRCLEGEN_H
@@ -23,10 +30,174 @@ struct dpixmap {
     dpixel *data;
 }; typedef struct dpixmap dpixmap;
 
+struct dgradient { // signed sobel response per pixel
+    int width;
+    int height;
+    float *dx;
+    float *dy;
+}; typedef struct dgradient dgradient;
+
+struct ddistmap { // euclidean distance to the nearest edge pixel
+    int width;
+    int height;
+    float *dist;
+}; typedef struct ddistmap ddistmap;
+
 typedef std::tuple<int, int> dpoint;
 typedef std::vector<dpoint> dpointlist;
 typedef std::tuple<double, double, double> dcircle;
 
+/**
+ * @brief Working set of points for circle fitting.
+ *        Points in [0, active) are live. Trimming swaps removed points past
+ *        the boundary in place, so a trim can be undone by restoring the
+ *        boundary it started from.
+ */
+struct dpointpool {
+    dpointlist points;
+    size_t active;
+    std::vector<size_t> marks; // boundaries before each uncommitted trim
+    uint64_t image;            // unique per pool: its points come from one image, see makePointpool
+    uint64_t generation;       // unique per set of live points, renewed by every trim and rollback
+}; typedef struct dpointpool dpointpool;
+
+// objective band: points further than this from a circle's edge don't count
+#define CG_LOSS_BAND 150.0
+
+struct dcacheentry {
+    dcircle circle;
+    bool accepted;
+}; typedef struct dcacheentry dcacheentry;
+
+struct dcirclecache { // converged fits, hashed by (cx, cy, r) in tolerance sized buckets
+    double tolerance;
+    std::unordered_map<long long, std::vector<dcacheentry>> buckets;
+}; typedef struct dcirclecache dcirclecache;
+
+// circle search strategy used by generateCircles
+enum cgengine {
+    CG_ENGINE_DESCENT, // random seed pair refined by BB gradient descent
+    CG_ENGINE_RANSAC,  // three point circumcircle hypotheses scored by inlier support
+    CG_ENGINE_HOUGH,   // gradient-oriented center voting, peaks refined by descent
+    CG_ENGINE_BATCH    // batches of random seed pairs refined together in lockstep
+};
+
+// local optimizer used to refine circle guesses
+enum cgfitter {
+    CG_FIT_DESCENT,       // Barzilai-Borwein gradient descent on fixed 3-vectors, no heap use
+    CG_FIT_DESCENT_FLOAT, // same in single precision
+    CG_FIT_GDCPP,         // the same descent through gdcpp's dynamic-size GradientDescent
+    CG_FIT_LM,            // algebraic (Kasa) init + Levenberg-Marquardt on geometric distances
+    CG_FIT_DISTANCE       // descent on an edge distance transform sampled along the circumference
+};
+
+// how the descent and batch engines draw initial guesses
+enum cgseeding {
+    CG_SEED_RANDOM,  // p1 as the center, p2 on the edge
+    CG_SEED_NORMAL,  // center on p1's gradient normal, on the circle through p2
+    CG_SEED_PAIR     // center where the gradient normals of p1 and p2 meet
+};
+
+// progressive output: called after every accepted circle with all circles
+// accepted so far, the newest last
+typedef void (*cgprogress)(const std::vector<dcircle> &circles, void *user);
+
+struct cgdeadline { // shared time budget of a run, see makeDeadline
+    bool bounded;                              // false: only cancel can stop the run
+    std::chrono::steady_clock::time_point end;
+    const std::atomic<bool> *cancel;           // (optional) set from any thread to stop early
+}; typedef struct cgdeadline cgdeadline;
+
+struct cgparams {
+    cgengine engine = CG_ENGINE_DESCENT;
+    const cgdeadline *deadline = nullptr; // (optional) engines return what they have once it expires
+    cgprogress progress = nullptr;        // (optional) per accepted circle
+    void *progressData = nullptr;         // handed to progress
+    cgfitter fitter = CG_FIT_DESCENT;
+    cgseeding seeding = CG_SEED_RANDOM;
+    int trimBand = 20;            // points this close to an accepted edge are removed
+    int maxIterations = 40;       // descent iteration cap per fit
+
+    // acceptance and early abort (descent fitters)
+    double acceptLoss = 0.0;      // accept fits with loss <= this; 0 accepts any finite loss
+    int abortWarmup = 5;          // iterations before a trajectory is judged
+    bool adaptiveBudget = true;   // shrink the iteration cap towards what accepted fits needed
+    int rateWindow = 20;          // attempts in the acceptance rate window
+    double minAcceptRate = 0.05;  // with acceptLoss, stop searching when the windowed rate drops below this
+    double dedupTolerance = 0.0;  // > 0: stop descents entering a basin already fitted within this many pixels
+
+    // rounds (descent engine)
+    int roundSize = 0;            // > 0: fit this many seeds in parallel per round against one snapshot
+    double roundOverlap = 0.1;    // largest share of a candidate's inliers already claimed in its round
+
+    // pyramid
+    int pyramidWidth = 0;         // > 0: search circles on a level at least this wide, refine them upwards
+    int pyramidPoints = 100;      // points sampled on every coarse level
+    int pyramidIterations = 8;    // descent iterations per circle on each finer level
+
+    // ransac
+    int ransacBatch = 64;         // hypotheses scored per batch
+    int ransacBatches = 8;        // batches tried per circle before giving up
+    int ransacMinSupport = 12;    // inliers needed to accept a hypothesis
+    double ransacNeighborhood = 150.0; // grid cell size for drawing the 2nd/3rd point
+
+    // hough
+    int houghCell = 2;            // accumulator cell size in pixels
+    int houghMinRadius = 20;
+    int houghMaxRadius = 0;       // 0 = half the larger image dimension
+    int houghMinVotes = 6;        // smoothed votes needed at a center peak
+
+    // levenberg-marquardt
+    int lmIterations = 10;
+
+    // batch
+    int batchSize = 16;           // candidates refined together per point sweep
+
+    // distance transform
+    double edgeThreshold = 0.75;  // sobel edge test, the threshold given to samplePoints
+    double distSpacing = 2.0;     // pixels between circumference samples
+    double distMinRadius = 10.0;  // radii below this are penalized quadratically
+}; typedef struct cgparams cgparams;
+
+struct cgstats {
+    long evaluations = 0;         // objective calls / hypotheses scored
+    long pointTests = 0;          // point-to-circle distance computations
+    long fits = 0;                // refineCircle calls
+    long iterations = 0;          // optimizer iterations over all fits
+    double fitSeconds = 0.0;      // wall time spent in refineCircle
+    double lossSum = 0.0;         // sum of final losses over all fits
+    long supportSum = 0;          // sum of points within trimBand of each fitted circle (benchmarkFitters)
+    long fitsAborted = 0;         // fits abandoned because they could not reach acceptLoss
+    long fitsAccepted = 0;        // fits that became circles
+    bool rateStopped = false;     // search ended because the acceptance rate collapsed
+    long cacheLookups = 0;        // descent iterates checked against the dedup cache
+    long cacheHits = 0;           // descents stopped because they reached a known circle
+    long rounds = 0;              // speculative rounds run (roundSize > 0)
+    long coarseFits = 0;          // fits on the pyramid levels below full resolution
+    double coarseSeconds = 0.0;   // wall time of the pyramid build and coarse levels
+    bool truncated = false;       // the deadline or a cancel ended the search before num circles
+}; typedef struct cgstats cgstats;
+
+// add the counters of one stats block into another
+void mergeStats(cgstats *into, const cgstats &from);
+
+/**
+ * @brief Start a time budget shared by the stages of one run
+ * @param seconds budget from now, <= 0 for none
+ * @param cancel (optional) flag another thread may set to stop the run
+ * @return the deadline, to be pointed at by cgparams.deadline
+ */
+cgdeadline makeDeadline(double seconds, const std::atomic<bool> *cancel);
+
+// true once the deadline has passed or its cancel flag was set; null never expires
+bool deadlineExpired(const cgdeadline *deadline);
+
+// deadlineExpired for an engine loop: also marks stats (optional) as truncated
+bool searchExpired(const cgparams &params, cgstats *stats);
+
+// engines call this right after accepting a circle; no-op without params.progress
+void reportProgress(const cgparams &params, const std::vector<dcircle> &circles);
+
 bool equalCircles(const dcircle &lhs, const dcircle &rhs, double epsilon);
 
 /**
@@ -49,18 +220,333 @@ void jitteredResample(dpixmap *pm, int new_width, double jitter);
  * @brief Save a dpixmap structure to an image file
  * @param pm dpixmap structure containing image data
  * @param points (optional) List of points to be saved
+ * @param circles circles to outline
+ * @param filename png to write
  */
-void saveImage(dpixmap pm, dpointlist *points, std::vector<dcircle> &circles);
+void saveImage(dpixmap pm, dpointlist *points, std::vector<dcircle> &circles,
+               const char *filename = "output.png");
 
 // for debugging
 void breakpointSaveImage(dpixmap *pm, dpointlist &points, dcircle &current, dcircle &last);
 
 dpixmap sobelFilter(dpixmap pm);
 
+/**
+ * @brief Signed sobel gradient of the red channel (same kernels as sobelFilter)
+ * @param pm a dpixmap
+ * @return dgradient owning two width * height float arrays
+ */
+dgradient sobelGradient(const dpixmap &pm);
+
 dpointlist samplePoints(dpixmap pm, int num, double threshold);
 
+/**
+ * @brief Wrap sampled points in a pool with all of them live
+ * @param points the points, all from the same image
+ * @return the pool, with an image and generation no other pool has had
+ */
+dpointpool makePointpool(dpointlist points);
+
+/**
+ * @brief Remove the points lying within threshold of a circle's edge
+ * @param pool the point pool (trimmed in place)
+ * @param circle the accepted circle
+ * @param threshold max distance from the circle's edge
+ * @return number of points removed
+ */
+size_t trimPointlist(dpointpool &pool, const dcircle &circle, int threshold);
+
+// undo the most recent uncommitted trim
+void rollbackTrim(dpointpool &pool);
+
+// forget all undo marks, making the current trims permanent
+void commitTrims(dpointpool &pool);
+
+/**
+ * @brief Refine the same random seed pairs with every fitter and print
+ *        iterations, evaluations, time, final loss and support per fit
+ * @param points sampled edge points
+ * @param pm the source image
+ * @param trials number of seed pairs
+ */
+void benchmarkFitters(const dpointlist &points, dpixmap *pm, int trials);
+
+/**
+ * @brief Label the fill sections of random circle sets (6, 32 and 256
+ *        circles) with span keys, vector keys and the automatic choice, and
+ *        print the time of each; then print the time and color error of
+ *        subsampled fills against the exact one, and the save and load time
+ *        and size of the exact fill's label map, checked against the
+ *        original after the round trip
+ * @param pm the source image
+ */
+void benchmarkFill(const dpixmap &pm);
+
 std::vector<dcircle> generateCircles(dpointlist &pointlist, dpixmap *pm, int num);
 
+/**
+ * @brief Fit up to num circles to a point list
+ * @param pointlist sampled edge points (left holding the unclaimed points)
+ * @param pm the source image
+ * @param num number of circles wanted
+ * @param params engine selection and tuning
+ * @param stats (optional) counters filled in by the engine
+ * @return the accepted circles
+ */
+std::vector<dcircle> generateCircles(dpointlist &pointlist, dpixmap *pm, int num,
+                                     const cgparams &params, cgstats *stats);
+
+/**
+ * @brief Look for a cached circle within the cache tolerance of circle
+ * @param cache the cache
+ * @param circle (cx, cy, r)
+ * @param entry (optional) receives the match
+ * @return true on a match
+ */
+bool findCircle(const dcirclecache &cache, const dcircle &circle, dcacheentry *entry);
+
+/**
+ * @brief Remember where a fit converged and whether it was accepted
+ */
+void rememberCircle(dcirclecache &cache, const dcircle &circle, bool accepted);
+
+/**
+ * @brief Drop the rejected fits, whose verdict may change once points are trimmed
+ */
+void forgetRejected(dcirclecache &cache);
+
+/**
+ * @brief Refine a circle guess against the live points with BB gradient descent
+ * @param pool the point pool
+ * @param pm the source image
+ * @param guess initial (cx, cy, r)
+ * @param params selects the fitter (params.fitter)
+ * @param loss (optional) receives the final objective value, NaN if the
+ *        descent was abandoned for not reaching params.acceptLoss, for
+ *        running into a circle of the cache or for running out of time
+ * @param stats (optional) counters to update
+ * @param cache (optional) converged fits; descent fitters stop as soon as
+ *        an iterate matches one
+ * @return the refined circle
+ */
+dcircle refineCircle(const dpointpool &pool, dpixmap *pm, const dcircle &guess,
+                     const cgparams &params, double *loss, cgstats *stats,
+                     const dcirclecache *cache = nullptr);
+
+/**
+ * @brief Geometric circle fit: Kasa algebraic fit over the points within
+ *        CG_LOSS_BAND of the guess, then Levenberg-Marquardt iterations on the
+ *        3x3 normal equations of the edge distances, reweighted (IRLS) to
+ *        minimize sum(min(|d - r|, CG_LOSS_BAND))
+ * @param pool the point pool
+ * @param guess initial (cx, cy, r), used to pick the inlier band
+ * @param max_iterations LM iteration cap
+ * @param loss (optional) receives the final mean edge distance
+ * @param iterations (optional) receives the LM iterations taken
+ * @param stats (optional) counters to update
+ * @return the fitted circle
+ */
+dcircle fitCircleLM(const dpointpool &pool, const dcircle &guess, int max_iterations,
+                    double *loss, int *iterations, cgstats *stats);
+
+/**
+ * @brief Refine many circle guesses at once with the same BB descent as
+ *        CG_FIT_DESCENT. The candidates and their finite difference probes are
+ *        kept as arrays and every iteration scores all of them in one pass
+ *        over the points; converged candidates drop out of the batch.
+ * @param pool the point pool
+ * @param candidates initial (cx, cy, r) guesses, replaced by the fitted circles
+ * @param max_iterations iteration cap per candidate
+ * @param losses receives the final objective value of each candidate
+ * @param stats (optional) counters to update
+ */
+void refineCircleBatch(const dpointpool &pool, std::vector<dcircle> &candidates, int max_iterations,
+                       std::vector<double> &losses, cgstats *stats);
+
+/**
+ * @brief Distance transform of the sobel edges of pm, restricted to the edges
+ *        within params.trimBand of a live pool point so claimed circles drop
+ *        out. Cached: rebuilt only when pm or the live point set changes.
+ * @param pool the point pool
+ * @param pm the source image
+ * @param params edge threshold and trim band
+ * @return the map, shared with the cache. It stays valid while held, even
+ *         after a later call for another pool replaces it in the cache
+ */
+std::shared_ptr<const ddistmap> edgeDistanceMap(const dpointpool &pool, const dpixmap *pm, const cgparams &params);
+
+/**
+ * @brief Draw an initial circle guess from the live points
+ * @param pool the point pool
+ * @param grad sobel gradient of the image, may be null for CG_SEED_RANDOM
+ * @param seeding the strategy; the gradient ones fall back to CG_SEED_RANDOM
+ *        where a point has no usable gradient
+ * @param gen random source
+ * @return (cx, cy, r)
+ */
+dcircle seedCircle(const dpointpool &pool, const dgradient *grad, cgseeding seeding, std::mt19937 &gen);
+
+// engine entry points, called by generateCircles on its point pool
+std::vector<dcircle> ransacCircles(dpointpool &pool, int num, const cgparams &params, cgstats *stats);
+std::vector<dcircle> houghCircles(dpointpool &pool, dpixmap *pm, int num, const cgparams &params, cgstats *stats);
+std::vector<dcircle> batchCircles(dpointpool &pool, dpixmap *pm, int num, const cgparams &params, cgstats *stats);
+std::vector<dcircle> pyramidCircles(dpointpool &pool, dpixmap *pm, int num, const cgparams &params, cgstats *stats);
+
+/**
+ * @brief A fill as a region id per pixel and a color per region. Ids are
+ *        dense and numbered in order of first appearance in row order.
+ */
+struct dlabelmap {
+    int width;
+    int height;
+    std::vector<uint32_t> label;  // region id of every pixel
+    std::vector<dpixel> palette;  // color of every region
+}; typedef struct dlabelmap dlabelmap;
+
+struct dregion { // one overlap section of an incremental fill
+    uint32_t count;
+    uint32_t hist[3][256];       // pixels per value of each channel
+    uint32_t cosum[3][256][2];   // sums of the next two channels over those pixels
+    dpixel color;                // median color, kept current by addFillCircle
+}; typedef struct dregion dregion;
+
+/**
+ * @brief Incremental fill: a region id per pixel and per region color
+ *        histograms. Adding a circle moves only the pixels it covers into
+ *        new regions and recolors only the regions involved.
+ */
+struct dfillmap {
+    const dpixmap *source;
+    std::vector<uint32_t> region;  // region id of every pixel
+    std::vector<dregion> regions;
+    std::vector<uint32_t> unused;  // ids of emptied regions, reused by later splits
+    std::vector<dcircle> circles;
+}; typedef struct dfillmap dfillmap;
+
+/**
+ * @brief Start an incremental fill of pm without any circles
+ * @param pm the source image, must outlive the fill
+ * @return the fill map
+ */
+dfillmap beginFill(const dpixmap &pm);
+
+/**
+ * @brief Add a circle to a fill in O(circle area): the covered pixels move to
+ *        new regions and the regions involved get their median recomputed
+ *        from the histograms
+ * @param fill the fill map
+ * @param circle the new circle
+ */
+void addFillCircle(dfillmap &fill, const dcircle &circle);
+
+/**
+ * @brief Paint every pixel of a fill with its region's color
+ * @param fill the fill map
+ * @return the filled image
+ */
+dpixmap renderFill(const dfillmap &fill);
+
+/**
+ * @brief The regions of a fill as a label map, without emptied regions
+ * @param fill the fill map
+ * @return the label map
+ */
+dlabelmap fillLabels(const dfillmap &fill);
+
+/**
+ * @brief Paint every pixel with the palette color of its label
+ * @param labels the label map
+ * @return the filled image
+ */
+dpixmap renderLabels(const dlabelmap &labels);
+
 dpixmap quantizeColors(const dpixmap &pm, std::vector<dcircle> &circles);
 
+/**
+ * @brief Fill every overlap section of the circles with its median color,
+ *        from per section histograms in time linear in the pixels
+ * @param pm the source image
+ * @param circles the circles
+ * @param deadline (optional) if expired once the histograms are built, each
+ *        section takes the per channel median, skipping the last pixel pass
+ * @param truncated (optional) set when the deadline cut the fill short
+ * @param sampleRate fraction of the pixels the colors are estimated from,
+ *        one per cell of a jittered grid; sections the grid misses are
+ *        counted in full. 1 is the exact fill
+ * @return the filled image
+ */
+dpixmap quantizeColors(const dpixmap &pm, std::vector<dcircle> &circles, const cgdeadline *deadline,
+                       bool *truncated, double sampleRate);
+
+/**
+ * @brief The fill of quantizeColors before it is painted: the overlap
+ *        section of every pixel and the color of every section
+ * @param pm the source image
+ * @param circles the circles
+ * @param deadline (optional) as in quantizeColors
+ * @param truncated (optional) as in quantizeColors
+ * @param sampleRate as in quantizeColors
+ * @return the label map
+ */
+dlabelmap labelColors(const dpixmap &pm, std::vector<dcircle> &circles, const cgdeadline *deadline,
+                      bool *truncated, double sampleRate);
+
+/**
+ * @brief Write a label map in a compact binary form: the magic "CGLM", a
+ *        version, width, height, palette size and palette, then the labels
+ *        in row order as runs of (length, code), both LEB128 varints, zlib
+ *        compressed after their raw and compressed byte counts. Code 0
+ *        repeats the label of the pixel above the run's first pixel, any
+ *        other code is label + 1. Header fields are little endian uint32,
+ *        palette entries 3 bytes of RGB
+ * @param labels the label map
+ * @param filename file to write
+ * @return false if the file could not be written
+ */
+bool saveLabelMap(const dlabelmap &labels, const char *filename);
+
+/**
+ * @brief Read a label map written by saveLabelMap
+ * @param filename file to read
+ * @return the label map, empty (0 x 0) if the file is missing or malformed
+ */
+dlabelmap loadLabelMap(const char *filename);
+
+/**
+ * @brief Write a label map as an 8 bit indexed png, one row at a time with
+ *        no RGB image in between. Regions of the same color share a palette
+ *        entry; with more than 256 colors the png is written as RGB rows
+ * @param labels the label map
+ * @param filename png to write
+ * @return false if the file could not be written
+ */
+bool saveIndexedImage(const dlabelmap &labels, const char *filename);
+
+/**
+ * @brief Write the fill as an SVG computed from the circle geometry: every
+ *        face of the arrangement becomes one path of circular arcs, colored
+ *        with the label most pixels sampled inside it carry, under the same
+ *        circle outlines saveImage draws
+ * @param circles the circles the label map was filled from
+ * @param labels the label map
+ * @param filename svg to write
+ * @return false if the file could not be written
+ */
+bool saveVectorImage(const std::vector<dcircle> &circles, const dlabelmap &labels, const char *filename);
+
+/**
+ * @brief Write the fill at another resolution, straight from the circles:
+ *        rows are filled in runs between circle crossings, each run in the
+ *        color its set of circles has in the label map, and the 1 px
+ *        outlines saveImage draws are scaled along and anti-aliased
+ * @param circles the circles the label map was filled from
+ * @param labels the label map
+ * @param scale output pixels per label map pixel
+ * @param filename png to write
+ * @return false if the scaled size is empty or beyond libpng's limits, or
+ *         the file could not be written
+ */
+bool saveScaledImage(const std::vector<dcircle> &circles, const dlabelmap &labels, double scale,
+                     const char *filename);
+
 #endif
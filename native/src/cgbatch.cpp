@@ -0,0 +1,269 @@
+/**
+ * @file cgbatch.cpp
+ * @author Jupiter Westbard
+ * @date 10/18/2026
+ * @brief batched lockstep circle descent for circlegen
+ */
+
+#include <iostream>
+#include <vector>
+#include <tuple>
+#include <cmath>
+#include <random>
+#include <limits>
+#include <chrono>
+#include <algorithm>
+
+#include "circlegen.h"
+
+void refineCircleBatch(const dpointpool &pool, std::vector<dcircle> &candidates, int max_iterations,
+                       std::vector<double> &losses, cgstats *stats);
+std::vector<dcircle> batchCircles(dpointpool &pool, dpixmap *pm, int num, const cgparams &params, cgstats *stats);
+
+// each candidate is probed at its center and +-eps/2 along cx, cy and r
+#define CG_BATCH_PROBES 7
+
+struct circlebatch_ { // candidates and their probe lanes, structure of arrays
+    std::vector<double> cx, cy, r;
+    std::vector<double> lx, ly, lr;  // lane circles, CG_BATCH_PROBES per live candidate
+    std::vector<double> sum;         // per lane: edge distance sum within the band
+    std::vector<double> count;       // per lane: points within the band (double keeps the sweep one type)
+}; typedef struct circlebatch_ circlebatch;
+
+struct pointsoa_ { // live pool points as two flat coordinate arrays
+    std::vector<double> x, y;
+}; typedef struct pointsoa_ pointsoa;
+
+static pointsoa splitPoints(const dpointpool &pool) {
+    pointsoa pts;
+    pts.x.resize(pool.active);
+    pts.y.resize(pool.active);
+    for (size_t i = 0; i < pool.active; ++i) {
+        pts.x[i] = std::get<0>(pool.points[i]);
+        pts.y[i] = std::get<1>(pool.points[i]);
+    }
+    return pts;
+}
+
+// one pass over the points for every lane: point-major, so each point is
+// loaded once and tested against all lanes, which the compiler can vectorize
+static void sweepLanes(const pointsoa &pts, circlebatch &batch, int lanes, double band) {
+    double *sum = batch.sum.data();
+    double *count = batch.count.data();
+    const double *lx = batch.lx.data();
+    const double *ly = batch.ly.data();
+    const double *lr = batch.lr.data();
+    std::fill(sum, sum + lanes, 0.0);
+    std::fill(count, count + lanes, 0.0);
+
+    for (size_t i = 0; i < pts.x.size(); ++i) {
+        double x = pts.x[i];
+        double y = pts.y[i];
+        #pragma omp simd
+        for (int j = 0; j < lanes; ++j) {
+            double dx = lx[j] - x;
+            double dy = ly[j] - y;
+            double dist_edge = std::abs(std::sqrt(dx * dx + dy * dy) - lr[j]);
+            double inside = dist_edge < band ? 1.0 : 0.0; // mask instead of a branch
+            sum[j] += inside * dist_edge;
+            count[j] += inside;
+        }
+    }
+}
+
+// refineCircleBatch on points already split into arrays, so a search can
+// split the pool once per accepted circle instead of once per batch
+static void refineLanes(const pointsoa &pts, std::vector<dcircle> &candidates, int max_iterations,
+                        std::vector<double> &losses, cgstats *stats) {
+    auto start = std::chrono::steady_clock::now();
+    const double eps = std::sqrt(std::numeric_limits<double>::epsilon());
+    const double min_gradient = 0.06; // same settings as the single fit descent
+    const double min_step = 1e-9;
+    const double const_step = 1e-4;
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+
+    size_t n = candidates.size();
+    circlebatch batch;
+    batch.cx.resize(n);
+    batch.cy.resize(n);
+    batch.r.resize(n);
+    for (size_t k = 0; k < n; ++k) {
+        batch.cx[k] = std::get<0>(candidates[k]);
+        batch.cy[k] = std::get<1>(candidates[k]);
+        batch.r[k] = std::get<2>(candidates[k]);
+    }
+    batch.lx.resize(n * CG_BATCH_PROBES);
+    batch.ly.resize(n * CG_BATCH_PROBES);
+    batch.lr.resize(n * CG_BATCH_PROBES);
+    batch.sum.resize(n * CG_BATCH_PROBES);
+    batch.count.resize(n * CG_BATCH_PROBES);
+
+    // per candidate BB state, as in CircleDescent::minimize
+    std::vector<double> step(3 * n, 0.0), last_x(3 * n, 0.0), last_grad(3 * n, 0.0);
+    std::vector<int> iterations(n, 0);
+    losses.assign(n, nan);
+
+    std::vector<size_t> live(n);
+    for (size_t k = 0; k < n; ++k) live[k] = k;
+
+    long evaluations = 0;
+    long tests = 0;
+    while (!live.empty()) {
+        // take the pending step and lay out the probe lanes of the live candidates
+        int lanes = 0;
+        for (size_t k : live) {
+            batch.cx[k] -= step[3 * k];
+            batch.cy[k] -= step[3 * k + 1];
+            batch.r[k] -= step[3 * k + 2];
+            for (int p = 0; p < CG_BATCH_PROBES; ++p) {
+                double offset = p == 0 ? 0.0 : ((p & 1) ? eps / 2 : -eps / 2);
+                int axis = (p - 1) / 2; // 0, 0, 1, 1, 2, 2 for the probes after the center
+                batch.lx[lanes] = batch.cx[k] + (p > 0 && axis == 0 ? offset : 0.0);
+                batch.ly[lanes] = batch.cy[k] + (p > 0 && axis == 1 ? offset : 0.0);
+                batch.lr[lanes] = batch.r[k] + (p > 0 && axis == 2 ? offset : 0.0);
+                ++lanes;
+            }
+        }
+
+        sweepLanes(pts, batch, lanes, CG_LOSS_BAND);
+        evaluations += lanes;
+        tests += (long)lanes * pts.x.size();
+
+        // central differences and a BB step for every live candidate
+        std::vector<size_t> next;
+        next.reserve(live.size());
+        for (size_t l = 0; l < live.size(); ++l) {
+            size_t k = live[l];
+            const double *sum = &batch.sum[l * CG_BATCH_PROBES];
+            const double *count = &batch.count[l * CG_BATCH_PROBES];
+            double f[CG_BATCH_PROBES];
+            for (int p = 0; p < CG_BATCH_PROBES; ++p) f[p] = sum[p] / count[p];
+
+            double x[3] = {batch.cx[k], batch.cy[k], batch.r[k]};
+            double grad[3];
+            for (int a = 0; a < 3; ++a) grad[a] = (f[1 + 2 * a] - f[2 + 2 * a]) / eps;
+            double grad_len = std::sqrt(grad[0] * grad[0] + grad[1] * grad[1] + grad[2] * grad[2]);
+
+            double step_size = const_step;
+            if (iterations[k] > 0) {
+                double sk_yk = 0.0, sk_sk = 0.0;
+                for (int a = 0; a < 3; ++a) {
+                    double sk = x[a] - last_x[3 * k + a];
+                    double yk = grad[a] - last_grad[3 * k + a];
+                    sk_yk += sk * yk;
+                    sk_sk += sk * sk;
+                }
+                step_size = sk_yk == 0 ? 1.0 : std::abs(sk_sk / sk_yk);
+            }
+            double step_len = 0.0;
+            for (int a = 0; a < 3; ++a) {
+                last_x[3 * k + a] = x[a];
+                last_grad[3 * k + a] = grad[a];
+                step[3 * k + a] = step_size * grad[a];
+                step_len += step[3 * k + a] * step[3 * k + a];
+            }
+            step_len = std::sqrt(step_len);
+
+            losses[k] = f[0];
+            ++iterations[k];
+            // NaN gradients fail both comparisons and end the candidate, like the single fit
+            if (iterations[k] < max_iterations && grad_len >= min_gradient && step_len >= min_step) {
+                next.push_back(k);
+            }
+        }
+        live.swap(next);
+    }
+
+    for (size_t k = 0; k < n; ++k) {
+        candidates[k] = std::make_tuple(batch.cx[k], batch.cy[k], batch.r[k]);
+    }
+    if (stats != nullptr) {
+        stats->evaluations += evaluations;
+        stats->pointTests += tests;
+        stats->fits += n;
+        for (size_t k = 0; k < n; ++k) {
+            stats->iterations += iterations[k];
+            if (std::isfinite(losses[k])) stats->lossSum += losses[k];
+        }
+        stats->fitSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+}
+
+void refineCircleBatch(const dpointpool &pool, std::vector<dcircle> &candidates, int max_iterations,
+                       std::vector<double> &losses, cgstats *stats) {
+    refineLanes(splitPoints(pool), candidates, max_iterations, losses, stats);
+}
+
+// candidates are seeded like the descent engine; every batch contributes its
+// best supported acceptable circle
+std::vector<dcircle> batchCircles(dpointpool &pool, dpixmap *pm, int num, const cgparams &params, cgstats *stats) {
+    std::random_device rd;
+    std::mt19937 gen(rd());
+    dgradient grad = {0, 0, nullptr, nullptr};
+    if (params.seeding != CG_SEED_RANDOM) grad = sobelGradient(*pm);
+
+    std::vector<dcircle> circles;
+    int batch_size = std::max(1, params.batchSize);
+    std::vector<dcircle> candidates(batch_size);
+    std::vector<double> losses;
+    circlebatch support;
+    support.sum.resize(batch_size);
+    support.count.resize(batch_size);
+    long tests = 0;
+    pointsoa pts = splitPoints(pool); // changes only when a circle is accepted
+
+    int fail_count = 0;
+    while ((int)circles.size() < num && pool.active > 3 && fail_count <= 100) {
+        if (searchExpired(params, stats)) break;
+        for (dcircle &candidate : candidates) {
+            candidate = seedCircle(pool, grad.dx != nullptr ? &grad : nullptr, params.seeding, gen);
+        }
+
+        refineLanes(pts, candidates, params.maxIterations, losses, stats);
+
+        // support of every candidate in one more sweep
+        support.lx.clear();
+        support.ly.clear();
+        support.lr.clear();
+        for (const dcircle &candidate : candidates) {
+            support.lx.push_back(std::get<0>(candidate));
+            support.ly.push_back(std::get<1>(candidate));
+            support.lr.push_back(std::get<2>(candidate));
+        }
+        // count within trimBand inclusive, the points trimPointlist would remove
+        sweepLanes(pts, support, batch_size, params.trimBand + 1e-9);
+        tests += (long)batch_size * pool.active;
+
+        int best = -1;
+        for (int k = 0; k < batch_size; ++k) {
+            double loss = losses[k];
+            bool accepted = loss > 0 && (params.acceptLoss <= 0 || loss <= params.acceptLoss);
+            if (accepted && (best < 0 || support.count[k] > support.count[best])) best = k;
+        }
+        if (best < 0) {
+            fail_count += batch_size;
+            continue;
+        }
+        fail_count = 0;
+
+        const dcircle &new_circle = candidates[best];
+        circles.push_back(new_circle);
+        trimPointlist(pool, new_circle, params.trimBand);
+        commitTrims(pool);
+        pts = splitPoints(pool);
+        reportProgress(params, circles);
+        std::cout << "Circle found."
+                  << " Center: (" << std::get<0>(new_circle) << ", " << std::get<1>(new_circle) << ")"
+                  << " Radius: " << std::get<2>(new_circle)
+                  << " Support: " << support.count[best] << std::endl;
+        std::cout << "Num points left: " << pool.active << std::endl;
+    }
+
+    if (stats != nullptr) {
+        stats->pointTests += tests;
+        stats->fitsAccepted += circles.size();
+    }
+    delete[] grad.dx;
+    delete[] grad.dy;
+    return circles;
+}
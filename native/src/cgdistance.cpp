@@ -0,0 +1,175 @@
+/**
+ * @file cgdistance.cpp
+ * @author Jupiter Westbard
+ * @date 10/18/2026
+ * @brief edge distance transform for circlegen
+ */
+
+#include <iostream>
+#include <vector>
+#include <tuple>
+#include <cmath>
+#include <algorithm>
+#include <memory>
+
+#include "circlegen.h"
+#include "cgdistance.h"
+
+std::shared_ptr<const ddistmap> edgeDistanceMap(const dpointpool &pool, const dpixmap *pm, const cgparams &params);
+static std::shared_ptr<const ddistmap> cachedDistanceMap(const dpointpool &pool, const dpixmap *pm, const cgparams &params);
+
+// Define static members of DistanceOptimization
+thread_local const ddistmap *DistanceOptimization::map = nullptr;
+thread_local long DistanceOptimization::evaluations = 0;
+thread_local long DistanceOptimization::samples = 0;
+thread_local long DistanceOptimization::inside = 0;
+
+#define CG_DIST_INF 1e20
+
+struct distcache_ { // the last map handed out and what it was built from
+    uint64_t image;                // pool.image the edge mask came from
+    int width;
+    int height;
+    double threshold;
+    std::vector<unsigned char> edges;
+    uint64_t generation;           // pool.generation the map was restricted to
+    int band;
+    std::shared_ptr<const ddistmap> map; // fits still holding an older map keep it alive
+}; typedef struct distcache_ distcache;
+
+static distcache cache = {0, 0, 0, 0.0, std::vector<unsigned char>(), 0, 0, nullptr};
+
+static void freeDistanceMap(const ddistmap *map) {
+    delete[] map->dist;
+    delete map;
+}
+
+// 1D squared distance transform of f (Felzenszwalb & Huttenlocher): lower
+// envelope of the parabolas rooted at every sample
+static void edt1d(const double *f, int n, double *d, int *v, double *z) {
+    int k = 0;
+    v[0] = 0;
+    z[0] = -CG_DIST_INF;
+    z[1] = CG_DIST_INF;
+    for (int q = 1; q < n; ++q) {
+        double s = ((f[q] + (double)q * q) - (f[v[k]] + (double)v[k] * v[k])) / (2.0 * q - 2.0 * v[k]);
+        while (s <= z[k]) {
+            --k;
+            s = ((f[q] + (double)q * q) - (f[v[k]] + (double)v[k] * v[k])) / (2.0 * q - 2.0 * v[k]);
+        }
+        ++k;
+        v[k] = q;
+        z[k] = s;
+        z[k + 1] = CG_DIST_INF;
+    }
+    k = 0;
+    for (int q = 0; q < n; ++q) {
+        while (z[k + 1] < q) ++k;
+        d[q] = (double)(q - v[k]) * (q - v[k]) + f[v[k]];
+    }
+}
+
+// squared euclidean distance to the nearest set pixel. Along a row the mask
+// is binary, so two linear scans give the distance; the column pass needs the
+// parabola envelope. Rows are written transposed so both passes read
+// contiguous memory.
+static std::vector<double> squaredDistance(const std::vector<unsigned char> &mask, int width, int height) {
+    std::vector<double> grid(mask.size());
+    std::vector<double> transposed(mask.size());
+
+    #pragma omp parallel
+    {
+        int n = std::max(width, height);
+        std::vector<double> d(n), z(n + 1);
+        std::vector<int> v(n);
+
+        #pragma omp for schedule(static)
+        for (int y = 0; y < height; ++y) {
+            const unsigned char *row = &mask[y * width];
+            double gap = CG_DIST_INF;
+            for (int x = 0; x < width; ++x) {
+                gap = row[x] ? 0.0 : gap + 1.0;
+                d[x] = gap;
+            }
+            gap = CG_DIST_INF;
+            for (int x = width - 1; x >= 0; --x) {
+                gap = row[x] ? 0.0 : gap + 1.0;
+                double nearest = std::min(d[x], gap);
+                transposed[x * height + y] = nearest >= CG_DIST_INF ? CG_DIST_INF : nearest * nearest;
+            }
+        }
+
+        #pragma omp for schedule(static)
+        for (int x = 0; x < width; ++x) {
+            edt1d(&transposed[x * height], height, d.data(), v.data(), z.data());
+            for (int y = 0; y < height; ++y) grid[y * width + x] = d[y];
+        }
+    }
+    return grid;
+}
+
+std::shared_ptr<const ddistmap> edgeDistanceMap(const dpointpool &pool, const dpixmap *pm, const cgparams &params) {
+    std::shared_ptr<const ddistmap> map;
+    // parallel fits share the cache; the first one to see a new pool rebuilds it
+    #pragma omp critical(cg_distance_cache)
+    map = cachedDistanceMap(pool, pm, params);
+    return map;
+}
+
+static std::shared_ptr<const ddistmap> cachedDistanceMap(const dpointpool &pool, const dpixmap *pm, const cgparams &params) {
+    int width = pm->width;
+    int height = pm->height;
+
+    // keyed on the pool's identities, not on addresses a freed pool or image could hand on
+    if (cache.image != pool.image || cache.width != width || cache.height != height ||
+        cache.threshold != params.edgeThreshold) {
+        // same edge test samplePoints applies to the sobel magnitudes
+        dpixmap filtered = sobelFilter(*pm);
+        cache.edges.assign(width * height, 0);
+        for (int i = 0; i < width * height; ++i) {
+            const dpixel &p = filtered.data[i];
+            double mag = std::sqrt(p.R * p.R + p.G * p.G + p.B * p.B);
+            cache.edges[i] = (255.0 - mag) / 255.0 < params.edgeThreshold;
+        }
+        delete[] filtered.data;
+
+        cache.image = pool.image;
+        cache.width = width;
+        cache.height = height;
+        cache.threshold = params.edgeThreshold;
+        cache.generation = 0;
+    }
+
+    if (cache.generation == pool.generation && cache.band == params.trimBand &&
+        cache.map != nullptr) {
+        return cache.map;
+    }
+
+    // keep the edge pixels that still have a live point nearby; the edges of
+    // accepted circles lost their points to trimPointlist and disappear
+    // (a disk per point is cheaper than a second transform for a few hundred points)
+    std::vector<unsigned char> live(width * height, 0);
+    int band = params.trimBand;
+    for (size_t i = 0; i < pool.active; ++i) {
+        int px = std::get<0>(pool.points[i]);
+        int py = std::get<1>(pool.points[i]);
+        for (int y = std::max(0, py - band); y <= std::min(height - 1, py + band); ++y) {
+            int half = (int)std::sqrt((double)band * band - (double)(y - py) * (y - py));
+            int x0 = std::max(0, px - half);
+            int x1 = std::min(width - 1, px + half);
+            for (int x = x0; x <= x1; ++x) {
+                live[y * width + x] |= cache.edges[y * width + x];
+            }
+        }
+    }
+    std::vector<double> dist2 = squaredDistance(live, width, height);
+
+    ddistmap *map = new ddistmap{width, height, new float[width * height]};
+    for (int i = 0; i < width * height; ++i) {
+        map->dist[i] = (float)std::sqrt(std::min(dist2[i], (double)CG_LOSS_BAND * CG_LOSS_BAND * 4));
+    }
+    cache.map = std::shared_ptr<const ddistmap>(map, freeDistanceMap);
+    cache.generation = pool.generation;
+    cache.band = params.trimBand;
+    return cache.map;
+}
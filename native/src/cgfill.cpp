@@ -5,111 +5,809 @@
  * @brief circlegen coloring implementations
  */
 
-#include "wasm_circlegen.h"
-
 #include <iostream>
+#include <fstream>
+#include <cstdio>
 #include <cmath>
 #include <cstdint>
 #include <vector>
 #include <unordered_map>
 #include <algorithm>
+#include <iomanip>
+#include <random>
+#include <chrono>
 
-struct dpixelidx { // pixel with index
-    uint8_t rgb[3];
-    int idx;
-}; typedef struct dpixelxy dpixelxy;
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
-struct overlapgroup_ {
-    std::unordered_map<uint32_t, std::vector<dpixelidx>> table;
-    std::vector<uint32_t> keys;
-}; typedef struct overlapgroup_ overlapgroup;
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
-dpixmap quantizeColors(const dpixmap &pm, std::vector<dcircle> &circles) {
-    overlapgroup ogroup = {std::unordered_map<uint32_t, std::vector<dpixelidx>>(), std::vector<uint32_t>()};
+#include "circlegen.h"
 
-    for (int y = 0; y < pm.height; ++y) {
-        for (int x = 0; x < pm.width; ++x) {
-            int index = y * pm.width + x;
-            uint8_t r = pm.data[index * 3];
-            uint8_t g = pm.data[index * 3 + 1];
-            uint8_t b = pm.data[index * 3 + 2];
-
-            // a pixel's hash key is a n bit number with each bit representing containment in a circle.
-            uint32_t key = 0;
-            for (int i = 0; i < circles.size(); ++i) {
-                float px = static_cast<float>(x);
-                float py = static_cast<float>(y);
-                float cx = std::get<0>(circles[i]);
-                float cy = std::get<1>(circles[i]);
-                float r = std::get<2>(circles[i]);
-                float dist = std::sqrt((px - cx) * (px - cx) + (py - cy) * (py - cy));
-                if (dist < r) {
-                    key |= 1U << i;
+#define CG_FILL_TILE 64
+#define CG_SAMPLE_RUN 4    // pixels per sample run of a subsampled fill
+#define CG_FILL_LANES 8          // circles per vector key step, the widest kernel
+#define CG_SPAN_ROW_COST 20.0    // chord of one span row, in pixel writes
+#define CG_VECTOR_STEP_COST 3.0  // one pixel against CG_FILL_LANES circles, in pixel writes
+
+struct dchannels_ { // channel histograms of one fill section
+    uint32_t count;
+    uint32_t hist[3][256];
+}; typedef struct dchannels_ dchannels;
+
+struct dlabels_ { // dense region id of every pixel
+    std::vector<uint32_t> label;
+    size_t count;
+}; typedef struct dlabels_ dlabels;
+
+enum dkeymode_ { // how a tile's containment keys are built
+    CG_KEYS_AUTO,       // whichever is cheaper for the tile
+    CG_KEYS_SPANS,      // each circle ORs its bit along one span per row
+    CG_KEYS_VECTOR      // each pixel is tested against CG_FILL_LANES circles at a time
+}; typedef enum dkeymode_ dkeymode;
+
+struct dcirclesoa_ { // crossing circles of a tile as arrays, padded to CG_FILL_LANES
+    std::vector<float> cx;
+    std::vector<float> cy;
+    std::vector<float> limit;  // squared distances below this are inside, see insideLimit
+}; typedef struct dcirclesoa_ dcirclesoa;
+
+struct dtile_ { // one CG_FILL_TILE square of the image, labeled on its own
+    int x0, y0, x1, y1;                        // pixels [x0, x1) x [y0, y1)
+    std::vector<std::vector<uint64_t>> sets;   // circles containing each local region, one bit per circle
+    std::vector<dchannels> channels;           // histograms of each local region
+    std::vector<uint32_t> first;               // first pixel of each local region
+    std::vector<uint32_t> global;              // image wide region id of each local region
+    std::vector<uint32_t> samples;             // pixels in the histograms, when subsampled
+}; typedef struct dtile_ dtile;
+
+// Subsampled fills take a short run of pixels on one row of every cell of a
+// tile, as offsets y * CG_FILL_TILE + x in row order. A run of 12 byte
+// pixels fills about a cache line, where single pixels would still pull in
+// every line of the image at rates down to a few percent. The run's place in
+// the cell is hashed from the cell, so the samples don't line up with
+// patterns in the image and are the same on every run; every tile uses the
+// same offsets. Empty for rates that round to all pixels
+static std::vector<uint32_t> samplePattern(double rate) {
+    // the cell size whose run covers the closest fraction of the cell
+    int side = 1, length = 1;
+    for (int s = 2; s <= CG_FILL_TILE; ++s) {
+        int l = std::min(s, CG_SAMPLE_RUN);
+        if (std::abs((double)l / (s * s) - rate) < std::abs((double)length / (side * side) - rate)) {
+            side = s;
+            length = l;
+        }
+    }
+    std::vector<uint32_t> pattern;
+    if (side == 1) return pattern;
+
+    for (int y0 = 0; y0 < CG_FILL_TILE; y0 += side) {
+        for (int x0 = 0; x0 < CG_FILL_TILE; x0 += side) {
+            uint32_t h = ((uint32_t)x0 * 0x9E3779B1u) ^ ((uint32_t)y0 * 0x85EBCA77u);
+            h ^= h >> 15;
+            h *= 0x2C1B3C6Du;
+            h ^= h >> 13;
+            int width = std::min(side, CG_FILL_TILE - x0);
+            int run = std::min(length, width);
+            int x = x0 + (int)(h & 0xFFFF) % (width - run + 1);
+            int y = y0 + (int)(h >> 16) % std::min(side, CG_FILL_TILE - y0);
+            for (int k = 0; k < run; ++k) pattern.push_back(y * CG_FILL_TILE + x + k);
+        }
+    }
+    std::sort(pattern.begin(), pattern.end());
+    return pattern;
+}
+
+// the per pixel containment test every fill applies
+static bool insideCircle(int x, int y, float cx, float cy, float r) {
+    float px = static_cast<float>(x);
+    float py = static_cast<float>(y);
+    float dist = std::sqrt((px - cx) * (px - cx) + (py - cy) * (py - cy));
+    return dist < r;
+}
+
+// pixels of row y inside the circle as the half open span [x0, x1), clipped
+// to the row. The span comes from the chord half width; its ends are then
+// moved by the exact test above, so the span holds the same pixels the test
+// accepts. Returns false if the row misses the circle.
+static bool circleSpan(const dcircle &circle, int y, int width, int &x0, int &x1) {
+    float cx = std::get<0>(circle);
+    float cy = std::get<1>(circle);
+    float r = std::get<2>(circle);
+    float dy = static_cast<float>(y) - cy;
+    float half = std::sqrt(std::max(0.0f, r * r - dy * dy));
+
+    int lo = (int)std::ceil(cx - half);
+    int hi = (int)std::floor(cx + half);
+    if (lo > hi) { // chord narrower than a pixel: test the two pixels around it
+        lo = (int)std::floor(cx);
+        hi = lo + 1;
+    }
+    while (lo <= hi && !insideCircle(lo, y, cx, cy, r)) ++lo;
+    while (hi >= lo && !insideCircle(hi, y, cx, cy, r)) --hi;
+    if (lo > hi) return false;
+    while (insideCircle(lo - 1, y, cx, cy, r)) --lo;
+    while (insideCircle(hi + 1, y, cx, cy, r)) ++hi;
+
+    x0 = std::max(0, lo);
+    x1 = std::min(width, hi + 1);
+    return x0 < x1;
+}
+
+// the smallest squared distance s with sqrt(s) >= r. sqrt is monotonic, so
+// s < limit is exactly insideCircle's sqrt(s) < r, without the sqrt
+static float insideLimit(float r) {
+    if (!(r > 0.0f)) return 0.0f;
+    float s = r * r;
+    while (s > 0.0f && std::sqrt(std::nextafter(s, 0.0f)) >= r) s = std::nextafter(s, 0.0f);
+    while (std::sqrt(s) < r) s = std::nextafter(s, INFINITY);
+    return s;
+}
+
+static dcirclesoa circleArrays(const std::vector<dcircle> &circles, const std::vector<size_t> &crossing) {
+    size_t padded = (crossing.size() + CG_FILL_LANES - 1) / CG_FILL_LANES * CG_FILL_LANES;
+    dcirclesoa soa = {std::vector<float>(padded, 0.0f), std::vector<float>(padded, 0.0f),
+                      std::vector<float>(padded, 0.0f)}; // padding lanes have limit 0 and are never inside
+    for (size_t j = 0; j < crossing.size(); ++j) {
+        soa.cx[j] = std::get<0>(circles[crossing[j]]);
+        soa.cy[j] = std::get<1>(circles[crossing[j]]);
+        soa.limit[j] = insideLimit(std::get<2>(circles[crossing[j]]));
+    }
+    return soa;
+}
+
+// Vector key kernels: bit j - first of row[x - x0] is set when pixel (x, y)
+// is inside circle j of soa, for j in [first, last). first is a multiple of
+// CG_FILL_LANES and the lanes past last are padding. The products and sum
+// are the same float operations insideCircle does, so the bits match it.
+template<typename Key>
+static void maskRowScalar(const dcirclesoa &soa, size_t first, size_t last, int y, int x0, int x1, Key *row) {
+    float py = (float)y;
+    for (int x = x0; x < x1; ++x) {
+        float px = (float)x;
+        Key key = 0;
+        for (size_t j = first; j < last; ++j) {
+            float dx = px - soa.cx[j];
+            float dy = py - soa.cy[j];
+            if (dx * dx + dy * dy < soa.limit[j]) key |= (Key)1 << (j - first);
+        }
+        row[x - x0] = key;
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+template<typename Key>
+__attribute__((target("sse2")))
+static void maskRowSSE2(const dcirclesoa &soa, size_t first, size_t last, int y, int x0, int x1, Key *row) {
+    __m128 py = _mm_set1_ps((float)y);
+    for (int x = x0; x < x1; ++x) {
+        __m128 px = _mm_set1_ps((float)x);
+        Key key = 0;
+        for (size_t j = first; j < last; j += 4) {
+            __m128 dx = _mm_sub_ps(px, _mm_loadu_ps(&soa.cx[j]));
+            __m128 dy = _mm_sub_ps(py, _mm_loadu_ps(&soa.cy[j]));
+            __m128 s = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+            key |= (Key)_mm_movemask_ps(_mm_cmplt_ps(s, _mm_loadu_ps(&soa.limit[j]))) << (j - first);
+        }
+        row[x - x0] = key;
+    }
+}
+
+template<typename Key>
+__attribute__((target("avx2")))
+static void maskRowAVX2(const dcirclesoa &soa, size_t first, size_t last, int y, int x0, int x1, Key *row) {
+    __m256 py = _mm256_set1_ps((float)y);
+    for (int x = x0; x < x1; ++x) {
+        __m256 px = _mm256_set1_ps((float)x);
+        Key key = 0;
+        for (size_t j = first; j < last; j += 8) {
+            __m256 dx = _mm256_sub_ps(px, _mm256_loadu_ps(&soa.cx[j]));
+            __m256 dy = _mm256_sub_ps(py, _mm256_loadu_ps(&soa.cy[j]));
+            __m256 s = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+            __m256 inside = _mm256_cmp_ps(s, _mm256_loadu_ps(&soa.limit[j]), _CMP_LT_OQ);
+            key |= (Key)_mm256_movemask_ps(inside) << (j - first);
+        }
+        row[x - x0] = key;
+    }
+}
+#endif
+
+// the widest kernel the CPU runs, picked once at run time
+static const char *keyKernelName() {
+#if defined(__x86_64__) || defined(__i386__)
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    return avx2 ? "avx2" : "sse2";
+#else
+    return "scalar";
+#endif
+}
+
+template<typename Key>
+static void maskRow(const dcirclesoa &soa, size_t first, size_t last, int y, int x0, int x1, Key *row) {
+#if defined(__x86_64__) || defined(__i386__)
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    if (avx2) maskRowAVX2(soa, first, last, y, x0, x1, row);
+    else maskRowSSE2(soa, first, last, y, x0, x1, row);
+#else
+    maskRowScalar(soa, first, last, y, x0, x1, row);
+#endif
+}
+
+// sort the circles reaching into a tile into the ones covering all of it
+// and the ones crossing it. The float distance grows with |dx| and |dy|, so
+// the nearest pixel decides whether any pixel is inside and the four corners
+// whether all of them are
+static void cullCircles(const std::vector<dcircle> &circles, const dtile &tile, std::vector<size_t> &crossing,
+                        std::vector<size_t> &covering) {
+    for (size_t i = 0; i < circles.size(); ++i) {
+        float cx = std::get<0>(circles[i]);
+        float cy = std::get<1>(circles[i]);
+        float r = std::get<2>(circles[i]);
+        int nx = std::min(std::max((int)std::lround(cx), tile.x0), tile.x1 - 1);
+        int ny = std::min(std::max((int)std::lround(cy), tile.y0), tile.y1 - 1);
+        if (!insideCircle(nx, ny, cx, cy, r)) continue;
+
+        if (insideCircle(tile.x0, tile.y0, cx, cy, r) && insideCircle(tile.x1 - 1, tile.y0, cx, cy, r) &&
+            insideCircle(tile.x0, tile.y1 - 1, cx, cy, r) && insideCircle(tile.x1 - 1, tile.y1 - 1, cx, cy, r)) {
+            covering.push_back(i);
+        }
+        else {
+            crossing.push_back(i);
+        }
+    }
+}
+
+template<typename Key>
+struct dsplithash_ {
+    size_t operator()(const std::pair<uint32_t, Key> &split) const {
+        return std::hash<uint64_t>()(((uint64_t)split.second * 0x9E3779B97F4A7C15ULL) ^ split.first);
+    }
+};
+
+struct dsethash_ {
+    size_t operator()(const std::vector<uint64_t> &set) const {
+        uint64_t h = 0;
+        for (uint64_t word : set) h = (h ^ word) * 0x9E3779B97F4A7C15ULL;
+        return std::hash<uint64_t>()(h ^ (h >> 29));
+    }
+};
+
+// tile keys of the crossing circles [first, last): each circle ORs its bit
+// along one span per row
+template<typename Key>
+static void spanKeys(const dtile &tile, const std::vector<dcircle> &circles, const std::vector<size_t> &crossing,
+                     size_t first, size_t last, int width, std::vector<Key> &keys) {
+    int tile_width = tile.x1 - tile.x0;
+    keys.assign(tile_width * (tile.y1 - tile.y0), 0);
+    for (size_t j = first; j < last; ++j) {
+        const dcircle &circle = circles[crossing[j]];
+        float cy = std::get<1>(circle);
+        float r = std::get<2>(circle);
+        int y0 = std::max(tile.y0, (int)std::floor(cy - r));
+        int y1 = std::min(tile.y1 - 1, (int)std::ceil(cy + r));
+        Key bit = (Key)1 << (j - first);
+        for (int y = y0; y <= y1; ++y) {
+            int x0, x1;
+            if (!circleSpan(circle, y, width, x0, x1)) continue;
+            Key *row = &keys[(y - tile.y0) * tile_width];
+            for (int x = std::max(x0, tile.x0); x < std::min(x1, tile.x1); ++x) row[x - tile.x0] |= bit;
+        }
+    }
+}
+
+// the same keys from the vector kernel, every pixel against every circle
+template<typename Key>
+static void vectorKeys(const dtile &tile, const dcirclesoa &soa, size_t first, size_t last, std::vector<Key> &keys) {
+    int tile_width = tile.x1 - tile.x0;
+    keys.resize(tile_width * (tile.y1 - tile.y0));
+    for (int y = tile.y0; y < tile.y1; ++y) {
+        maskRow(soa, first, last, y, tile.x0, tile.x1, &keys[(y - tile.y0) * tile_width]);
+    }
+}
+
+// split the local regions of a tile by the keys of the crossing circles
+// [first, last): pixels sharing a region and a key get the same new local
+// id, in order of first appearance. Neighboring pixels mostly share both,
+// so the previous pixel's pair is checked before the table
+template<typename Key>
+static void splitTile(dtile &tile, const std::vector<size_t> &crossing, size_t first, size_t last, int width,
+                      std::vector<uint32_t> &label, const std::vector<Key> &keys) {
+    int tile_width = tile.x1 - tile.x0;
+    std::unordered_map<std::pair<uint32_t, Key>, uint32_t, dsplithash_<Key>> ids;
+    std::vector<std::vector<uint64_t>> sets;
+    std::vector<uint32_t> firsts;
+    std::pair<uint32_t, Key> last_split(0, 0);
+    uint32_t last_id = 0;
+    for (int y = tile.y0; y < tile.y1; ++y) {
+        for (int x = tile.x0; x < tile.x1; ++x) {
+            uint32_t &id = label[y * width + x];
+            std::pair<uint32_t, Key> split(id, keys[(y - tile.y0) * tile_width + x - tile.x0]);
+            if (sets.empty() || split != last_split) {
+                auto found = ids.emplace(split, (uint32_t)sets.size());
+                if (found.second) {
+                    firsts.push_back(y * width + x);
+                    sets.push_back(tile.sets[split.first]);
+                    for (size_t j = first; j < last; ++j) {
+                        if (split.second >> (j - first) & 1) sets.back()[crossing[j] / 64] |= 1ULL << crossing[j] % 64;
+                    }
                 }
+                last_split = split;
+                last_id = found.first->second;
+            }
+            id = last_id;
+        }
+    }
+    tile.sets.swap(sets);
+    tile.first.swap(firsts);
+}
+
+// Spans touch only the pixels a circle covers but pay a chord per row and
+// scatter bit writes; the vector kernel tests every pixel of the tile once
+// per CG_FILL_LANES circles. Both estimates are in pixel writes, the weights
+// come from benchmarkFill
+static dkeymode keyMode(const dtile &tile, const std::vector<dcircle> &circles, const std::vector<size_t> &crossing) {
+    double tile_width = tile.x1 - tile.x0;
+    double tile_height = tile.y1 - tile.y0;
+    double spans = 0.0;
+    for (size_t i : crossing) {
+        double d = 2.0 * std::get<2>(circles[i]);
+        spans += std::min(tile_height, d) * (CG_SPAN_ROW_COST + std::min(tile_width, d));
+    }
+    double steps = (double)((crossing.size() + CG_FILL_LANES - 1) / CG_FILL_LANES);
+    double vector = tile_width * tile_height * steps * CG_VECTOR_STEP_COST;
+    return vector < spans ? CG_KEYS_VECTOR : CG_KEYS_SPANS;
+}
+
+static void countChannels(dchannels &region, const dpixel &p) {
+    ++region.count;
+    ++region.hist[0][p.R];
+    ++region.hist[1][p.G];
+    ++region.hist[2][p.B];
+}
+
+// keys of one chunk of crossing circles, then the split by them
+template<typename Key>
+static void splitChunk(dtile &tile, const std::vector<dcircle> &circles, const std::vector<size_t> &crossing,
+                       const dcirclesoa &soa, size_t first, int width, dkeymode mode, std::vector<uint32_t> &label) {
+    size_t last = std::min(crossing.size(), first + 8 * sizeof(Key));
+    std::vector<Key> keys;
+    if (mode == CG_KEYS_VECTOR) vectorKeys(tile, soa, first, last, keys);
+    else spanKeys(tile, circles, crossing, first, last, width, keys);
+    splitTile(tile, crossing, first, last, width, label, keys);
+}
+
+// local regions of one tile and their histograms. Covering circles add the
+// same bit to every pixel and need no per pixel work; the key width is fixed
+// at compile time, so up to 32 crossing circles (the usual case even with
+// hundreds in the image) take a single 32 bit pass
+static void labelTile(dtile &tile, const dpixmap &pm, const std::vector<dcircle> &circles, dkeymode mode,
+                      const std::vector<uint32_t> &pattern, std::vector<uint32_t> &label) {
+    std::vector<size_t> crossing, covering;
+    cullCircles(circles, tile, crossing, covering);
+
+    std::vector<uint64_t> base((circles.size() + 63) / 64, 0);
+    for (size_t i : covering) base[i / 64] |= 1ULL << i % 64;
+    tile.sets.assign(1, base);
+    tile.first.assign(1, tile.y0 * pm.width + tile.x0);
+    for (int y = tile.y0; y < tile.y1; ++y) {
+        std::fill(&label[y * pm.width + tile.x0], &label[y * pm.width + tile.x1], 0);
+    }
+    if (crossing.empty()) mode = CG_KEYS_SPANS;
+    if (mode == CG_KEYS_AUTO) mode = keyMode(tile, circles, crossing);
+    dcirclesoa soa;
+    if (mode == CG_KEYS_VECTOR) soa = circleArrays(circles, crossing);
+
+    if (crossing.size() <= 32) {
+        if (!crossing.empty()) splitChunk<uint32_t>(tile, circles, crossing, soa, 0, pm.width, mode, label);
+    }
+    else {
+        for (size_t first = 0; first < crossing.size(); first += 64) {
+            splitChunk<uint64_t>(tile, circles, crossing, soa, first, pm.width, mode, label);
+        }
+    }
+
+    tile.channels.assign(tile.sets.size(), dchannels());
+    if (pattern.empty()) {
+        for (int y = tile.y0; y < tile.y1; ++y) {
+            for (int x = tile.x0; x < tile.x1; ++x) {
+                countChannels(tile.channels[label[y * pm.width + x]], pm.data[y * pm.width + x]);
             }
+        }
+        return;
+    }
+
+    tile.samples.reserve(pattern.size());
+    for (uint32_t offset : pattern) {
+        int x = tile.x0 + offset % CG_FILL_TILE;
+        int y = tile.y0 + offset / CG_FILL_TILE;
+        if (x < tile.x1 && y < tile.y1) tile.samples.push_back(y * pm.width + x); // edge tiles are cut short
+    }
+    for (uint32_t index : tile.samples) countChannels(tile.channels[label[index]], pm.data[index]);
+
+    // slivers the grid missed take their first pixel, so every region has a color
+    for (size_t k = 0; k < tile.channels.size(); ++k) {
+        if (tile.channels[k].count > 0) continue;
+        countChannels(tile.channels[k], pm.data[tile.first[k]]);
+        tile.samples.push_back(tile.first[k]);
+    }
+}
+
+// dense region ids of the overlap sections and their histograms. Tiles are
+// labeled in parallel; their local regions are then matched up by circle set
+// in tile order, so the ids don't depend on the thread count. With a sample
+// pattern the histograms hold only the pixels listed in samples
+static dlabels labelRegions(const dpixmap &pm, const std::vector<dcircle> &circles, dkeymode mode,
+                            const std::vector<uint32_t> &pattern, std::vector<dchannels> &channels,
+                            std::vector<uint32_t> &samples) {
+    dlabels labels = {std::vector<uint32_t>(pm.width * pm.height, 0), 0};
+    std::vector<dtile> tiles;
+    for (int y = 0; y < pm.height; y += CG_FILL_TILE) {
+        for (int x = 0; x < pm.width; x += CG_FILL_TILE) {
+            tiles.push_back({x, y, std::min(x + CG_FILL_TILE, pm.width), std::min(y + CG_FILL_TILE, pm.height),
+                             {}, {}, {}, {}, {}});
+        }
+    }
+
+    #pragma omp parallel for schedule(dynamic)
+    for (long t = 0; t < (long)tiles.size(); ++t) {
+        labelTile(tiles[t], pm, circles, mode, pattern, labels.label);
+    }
+
+    std::unordered_map<std::vector<uint64_t>, uint32_t, dsethash_> ids;
+    for (dtile &tile : tiles) {
+        tile.global.resize(tile.sets.size());
+        for (size_t k = 0; k < tile.sets.size(); ++k) {
+            auto found = ids.emplace(tile.sets[k], (uint32_t)channels.size());
+            if (found.second) channels.push_back(dchannels());
+            dchannels &region = channels[found.first->second];
+            const dchannels &local = tile.channels[k];
+            region.count += local.count;
+            for (int c = 0; c < 3; ++c) {
+                for (int v = 0; v < 256; ++v) region.hist[c][v] += local.hist[c][v];
+            }
+            tile.global[k] = found.first->second;
+        }
+        std::vector<dchannels>().swap(tile.channels);
+        samples.insert(samples.end(), tile.samples.begin(), tile.samples.end());
+    }
+    labels.count = channels.size();
 
-            // create the new dpixel and add it to the hash table
-            dpixelidx pixel = {{r, g, b}, index};
-            if (ogroup.table.find(key) == ogroup.table.end()) { // group not found
-                ogroup.keys.push_back(key);
-                ogroup.table[key] = std::vector<dpixelidx>();
+    #pragma omp parallel for schedule(static)
+    for (long t = 0; t < (long)tiles.size(); ++t) {
+        const dtile &tile = tiles[t];
+        for (int y = tile.y0; y < tile.y1; ++y) {
+            for (int x = tile.x0; x < tile.x1; ++x) {
+                uint32_t &id = labels.label[y * pm.width + x];
+                id = tile.global[id];
             }
-            ogroup.table[key].push_back(pixel);
         }
     }
+    return labels;
+}
+
+// the dominant channel (the one with the highest range) of count pixels and
+// its median: the value pixels[count / 2] has after sorting by that channel,
+// found by walking the cumulative counts in O(256)
+static int medianValue(const uint32_t (&hist)[3][256], uint32_t count, int *dominant) {
+    int range[3];
+    for (int c = 0; c < 3; ++c) {
+        int lo = 0, hi = 255;
+        while (hist[c][lo] == 0) ++lo;
+        while (hist[c][hi] == 0) --hi;
+        range[c] = hi - lo;
+    }
+    *dominant = 0;
+    if (range[1] > range[0]) *dominant = 1;
+    if (range[2] > range[0] && range[2] > range[1]) *dominant = 2;
+
+    uint32_t rank = count / 2;
+    uint32_t seen = 0;
+    int median = 0;
+    while (seen + hist[*dominant][median] <= rank) seen += hist[*dominant][median++];
+    return median;
+}
 
-    std::cout << "Found " << ogroup.keys.size() << " fill sections." << std::endl;
+dpixmap quantizeColors(const dpixmap &pm, std::vector<dcircle> &circles) {
+    return quantizeColors(pm, circles, nullptr, nullptr, 1.0);
+}
+
+dpixmap quantizeColors(const dpixmap &pm, std::vector<dcircle> &circles, const cgdeadline *deadline,
+                       bool *truncated, double sampleRate) {
+    return renderLabels(labelColors(pm, circles, deadline, truncated, sampleRate));
+}
 
-    for (auto &key : ogroup.keys) {
-        std::vector<dpixelidx> &pixels = ogroup.table[key];
+dlabelmap labelColors(const dpixmap &pm, std::vector<dcircle> &circles, const cgdeadline *deadline,
+                      bool *truncated, double sampleRate) {
+    std::vector<uint32_t> pattern;
+    if (sampleRate > 0.0 && sampleRate < 1.0) pattern = samplePattern(sampleRate);
+    bool sampled = !pattern.empty();
+    std::vector<dchannels> channels;
+    std::vector<uint32_t> samples;
+    dlabels labels = labelRegions(pm, circles, CG_KEYS_AUTO, pattern, channels, samples);
+    size_t count = labels.count;
+    std::cout << "Found " << count << " fill sections." << std::endl;
 
-        // find the dominant channel (the r, g, or b channel with the highest range)
-        int rmin = 255, rmax = 0;
-        int gmin = 255, gmax = 0;
-        int bmin = 255, bmax = 0;
-        for (auto &pixel : pixels) {
-            if (pixel.rgb[0] < rmin) rmin = pixel.rgb[0];
-            if (pixel.rgb[0] > rmax) rmax = pixel.rgb[0];
-            if (pixel.rgb[1] < gmin) gmin = pixel.rgb[1];
-            if (pixel.rgb[1] > gmax) gmax = pixel.rgb[1];
-            if (pixel.rgb[2] < bmin) bmin = pixel.rgb[2];
-            if (pixel.rgb[2] > bmax) bmax = pixel.rgb[2];
+    std::vector<int> dominant(count), median(count);
+    #pragma omp parallel for schedule(static)
+    for (long k = 0; k < (long)count; ++k) median[k] = medianValue(channels[k].hist, channels[k].count, &dominant[k]);
+
+    // third pass: the other two channels are the mean over the pixels at the
+    // dominant median, as in the incremental fill. Past the deadline that pass
+    // is skipped and they take their own channel's median instead
+    bool expired = deadlineExpired(deadline);
+    int threads = 1;
+#ifdef _OPENMP
+    threads = omp_get_max_threads();
+#endif
+    std::vector<uint64_t> sums(count * 2, 0);
+    if (!expired) {
+        std::vector<uint64_t> local(count * 2 * threads, 0);
+        #pragma omp parallel
+        {
+            int thread = 0;
+#ifdef _OPENMP
+            thread = omp_get_thread_num();
+#endif
+            uint64_t *acc = &local[count * 2 * thread];
+
+            // every pixel, or only the ones in the histograms when subsampled
+            long pixels = sampled ? (long)samples.size() : (long)pm.width * pm.height;
+            #pragma omp for schedule(static)
+            for (long i = 0; i < pixels; ++i) {
+                long index = sampled ? (long)samples[i] : i;
+                const dpixel &p = pm.data[index];
+                uint32_t id = labels.label[index];
+                int rgb[3] = {p.R, p.G, p.B};
+                int d = dominant[id];
+                if (rgb[d] != median[id]) continue;
+                acc[id * 2] += rgb[(d + 1) % 3];
+                acc[id * 2 + 1] += rgb[(d + 2) % 3];
+            }
+
+            // reduce the per-thread sums
+            #pragma omp for schedule(static)
+            for (long k = 0; k < (long)count * 2; ++k) {
+                for (int t = 0; t < threads; ++t) sums[k] += local[count * 2 * t + k];
+            }
+        }
+    }
+
+    std::vector<dpixel> colors(count);
+    for (size_t k = 0; k < count; ++k) {
+        const dchannels &region = channels[k];
+        int d = dominant[k];
+        int rgb[3];
+        rgb[d] = median[k];
+        for (int j = 1; j <= 2; ++j) {
+            int c = (d + j) % 3;
+            if (expired) {
+                uint32_t seen = 0;
+                rgb[c] = 0;
+                while (seen + region.hist[c][rgb[c]] <= region.count / 2) seen += region.hist[c][rgb[c]++];
+            }
+            else {
+                uint64_t n = region.hist[d][median[k]];
+                rgb[c] = (int)((sums[k * 2 + j - 1] + n / 2) / n);
+            }
         }
-        int rrange = rmax - rmin;
-        int grange = gmax - gmin;
-        int brange = bmax - bmin;
-        int dominant = 0;
-        if (grange > rrange) dominant = 1;
-        if (brange > rrange && brange > grange) dominant = 2;
+        colors[k] = {rgb[0], rgb[1], rgb[2]};
+    }
+
+    if (truncated != nullptr) *truncated = expired;
+    return {pm.width, pm.height, std::move(labels.label), std::move(colors)};
+}
+
+// one linear pass over the labels
+dpixmap renderLabels(const dlabelmap &labels) {
+    dpixmap res = {labels.width, labels.height, new dpixel[labels.width * labels.height]};
+    #pragma omp parallel for schedule(static)
+    for (long index = 0; index < (long)labels.width * labels.height; ++index) {
+        res.data[index] = labels.palette[labels.label[index]];
+    }
+    return res;
+}
+
+// the median color of a region from its histograms: the dominant channel is
+// walked up to the middle pixel, and the other channels are the mean of the
+// pixels sharing that dominant value
+static void regionColor(dregion &region) {
+    if (region.count == 0) return;
+    int dominant;
+    int median = medianValue(region.hist, region.count, &dominant);
+
+    uint32_t n = region.hist[dominant][median];
+    int other[2] = {(int)((region.cosum[dominant][median][0] + n / 2) / n),
+                    (int)((region.cosum[dominant][median][1] + n / 2) / n)};
+    int rgb[3];
+    rgb[dominant] = median;
+    rgb[(dominant + 1) % 3] = other[0];
+    rgb[(dominant + 2) % 3] = other[1];
+    region.color = {rgb[0], rgb[1], rgb[2]};
+}
+
+// add (sign 1) or remove (sign -1) one pixel from a region's histograms
+static void countPixel(dregion &region, const dpixel &p, int sign) {
+    int rgb[3] = {p.R, p.G, p.B};
+    region.count += sign;
+    for (int c = 0; c < 3; ++c) {
+        region.hist[c][rgb[c]] += sign;
+        region.cosum[c][rgb[c]][0] += sign * rgb[(c + 1) % 3];
+        region.cosum[c][rgb[c]][1] += sign * rgb[(c + 2) % 3];
+    }
+}
+
+dfillmap beginFill(const dpixmap &pm) {
+    dfillmap fill = {&pm, std::vector<uint32_t>(pm.width * pm.height, 0), std::vector<dregion>(1),
+                     std::vector<uint32_t>(), std::vector<dcircle>()};
+    dregion &all = fill.regions[0];
+    all.count = 0;
+    for (int i = 0; i < pm.width * pm.height; ++i) countPixel(all, pm.data[i], 1);
+    regionColor(all);
+    return fill;
+}
+
+// an empty region, preferring the id of one a previous circle emptied
+static uint32_t newRegion(dfillmap &fill) {
+    if (fill.unused.empty()) {
+        fill.regions.push_back(dregion());
+        return fill.regions.size() - 1;
+    }
+    uint32_t id = fill.unused.back();
+    fill.unused.pop_back();
+    fill.regions[id] = dregion();
+    return id;
+}
 
-        // sort pixels by dominant channel
-        std::sort(pixels.begin(), pixels.end(), [dominant](const dpixelidx &a, const dpixelidx &b) {
-            return a.rgb[dominant] < b.rgb[dominant];
-        });
+void addFillCircle(dfillmap &fill, const dcircle &circle) {
+    const dpixmap &pm = *fill.source;
+    fill.circles.push_back(circle);
 
-        // get median pixel (middle pixel in sorted list)
-        dpixelidx median = pixels[pixels.size() / 2];
+    float cy = std::get<1>(circle);
+    float r = std::get<2>(circle);
+    int y0 = std::max(0, (int)std::floor(cy - r));
+    int y1 = std::min(pm.height - 1, (int)std::ceil(cy + r));
 
-        // set all pixels to median pixel
-        for (auto &pixel : pixels) {
-            pixel.rgb[0] = median.rgb[0];
-            pixel.rgb[1] = median.rgb[1];
-            pixel.rgb[2] = median.rgb[2];
+    // the new circle splits every region it covers: the covered part of
+    // region k becomes a new region, and no other region shares it, so
+    // regions only ever split and never merge. Region ids carry no circle
+    // bits, so there is no limit on the number of circles
+    size_t old_count = fill.regions.size();
+    std::vector<uint32_t> split(old_count, 0); // new region id + 1, 0 until needed
+    for (int y = y0; y <= y1; ++y) {
+        int x0, x1;
+        if (!circleSpan(circle, y, pm.width, x0, x1)) continue;
+        for (int x = x0; x < x1; ++x) {
+            int index = y * pm.width + x;
+            uint32_t from = fill.region[index];
+            if (split[from] == 0) {
+                split[from] = newRegion(fill) + 1;
+            }
+            uint32_t to = split[from] - 1;
+            countPixel(fill.regions[from], pm.data[index], -1);
+            countPixel(fill.regions[to], pm.data[index], 1);
+            fill.region[index] = to;
         }
     }
 
-    // create the new dpixmap
-    dpixmap res;
-    res.width = pm.width;
-    res.height = pm.height;
-    res.data = new uint8_t[pm.width * pm.height * 3];
+    // only the regions that lost or gained pixels change color; a region the
+    // circle covered whole is left empty and its id is reused
+    for (size_t k = 0; k < old_count; ++k) {
+        if (split[k] == 0) continue;
+        regionColor(fill.regions[k]);
+        regionColor(fill.regions[split[k] - 1]);
+        if (fill.regions[k].count == 0) fill.unused.push_back(k);
+    }
+}
 
-    for (auto &key : ogroup.keys) {
-        for (auto &pixel : ogroup.table[key]) {
-            res.data[pixel.idx * 3] = pixel.rgb[0];
-            res.data[pixel.idx * 3 + 1] = pixel.rgb[1];
-            res.data[pixel.idx * 3 + 2] = pixel.rgb[2];
+// regions emptied by later circles are left out, so the palette stays dense
+dlabelmap fillLabels(const dfillmap &fill) {
+    const dpixmap &pm = *fill.source;
+    std::vector<uint32_t> dense(fill.regions.size(), UINT32_MAX);
+    dlabelmap labels = {pm.width, pm.height, std::vector<uint32_t>(pm.width * pm.height), std::vector<dpixel>()};
+    for (int i = 0; i < pm.width * pm.height; ++i) {
+        uint32_t id = fill.region[i];
+        if (dense[id] == UINT32_MAX) {
+            dense[id] = (uint32_t)labels.palette.size();
+            labels.palette.push_back(fill.regions[id].color);
         }
+        labels.label[i] = dense[id];
     }
+    return labels;
+}
+
+dpixmap renderFill(const dfillmap &fill) {
+    const dpixmap &pm = *fill.source;
+    dpixmap res = {pm.width, pm.height, new dpixel[pm.width * pm.height]};
+    for (int i = 0; i < pm.width * pm.height; ++i) res.data[i] = fill.regions[fill.region[i]].color;
     return res;
 }
+
+// best of a few runs of labelRegions with the given key mode, in ms
+static double timeLabels(const dpixmap &pm, const std::vector<dcircle> &circles, dkeymode mode, dlabels &labels) {
+    double best = 0.0;
+    for (int run = 0; run < 3; ++run) {
+        std::vector<dchannels> channels;
+        std::vector<uint32_t> samples;
+        auto start = std::chrono::steady_clock::now();
+        labels = labelRegions(pm, circles, mode, std::vector<uint32_t>(), channels, samples);
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        if (run == 0 || ms < best) best = ms;
+    }
+    return best;
+}
+
+void benchmarkFill(const dpixmap &pm) {
+    std::mt19937 gen(12345);
+    std::uniform_real_distribution<float> cx(0.0f, (float)pm.width);
+    std::uniform_real_distribution<float> cy(0.0f, (float)pm.height);
+    float side = (float)std::min(pm.width, pm.height);
+    std::uniform_real_distribution<float> r(side / 40.0f, side / 3.0f);
+
+    std::cout << "\nfill keys (" << keyKernelName() << ")" << std::endl;
+    std::cout << "circles   spans ms   vector ms   auto ms   regions" << std::endl;
+    for (int count : {6, 32, 256}) {
+        std::vector<dcircle> circles;
+        for (int k = 0; k < count; ++k) circles.push_back(std::make_tuple(cx(gen), cy(gen), r(gen)));
+        dlabels spans, vector, automatic;
+        double spans_ms = timeLabels(pm, circles, CG_KEYS_SPANS, spans);
+        double vector_ms = timeLabels(pm, circles, CG_KEYS_VECTOR, vector);
+        double auto_ms = timeLabels(pm, circles, CG_KEYS_AUTO, automatic);
+        bool same = spans.label == vector.label && spans.label == automatic.label;
+        std::cout << std::left << std::setw(10) << count << std::fixed << std::setprecision(2)
+                  << std::setw(11) << spans_ms << std::setw(12) << vector_ms << std::setw(10) << auto_ms
+                  << spans.count << (same ? "" : " (labels differ)") << std::endl;
+    }
+
+    // subsampled colors against the exact fill of the last circle set
+    std::vector<dcircle> circles;
+    for (int k = 0; k < 32; ++k) circles.push_back(std::make_tuple(cx(gen), cy(gen), r(gen)));
+    dpixmap exact = quantizeColors(pm, circles);
+    std::cout << "\nfill sample   ms         mean |delta|   max |delta|   pixels changed" << std::endl;
+    for (double rate : {1.0, 0.25, 0.1, 0.04, 0.01}) {
+        auto start = std::chrono::steady_clock::now();
+        dpixmap approx = quantizeColors(pm, circles, nullptr, nullptr, rate);
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        double total = 0.0;
+        int worst = 0;
+        long changed = 0;
+        for (int i = 0; i < pm.width * pm.height; ++i) {
+            const dpixel &a = exact.data[i];
+            const dpixel &b = approx.data[i];
+            int delta[3] = {std::abs(a.R - b.R), std::abs(a.G - b.G), std::abs(a.B - b.B)};
+            total += delta[0] + delta[1] + delta[2];
+            worst = std::max(worst, std::max(delta[0], std::max(delta[1], delta[2])));
+            changed += delta[0] + delta[1] + delta[2] > 0;
+        }
+        std::cout << std::left << std::setw(14) << rate << std::setw(11) << ms
+                  << std::setw(15) << total / (3.0 * pm.width * pm.height) << std::setw(14) << worst
+                  << 100.0 * changed / (pm.width * pm.height) << "%" << std::endl;
+        delete[] approx.data;
+    }
+    delete[] exact.data;
+
+    // the exact fill's label map through saveLabelMap and back
+    const char *filename = "bench_labels.cglm";
+    dlabelmap labels = labelColors(pm, circles, nullptr, nullptr, 1.0);
+    auto start = std::chrono::steady_clock::now();
+    bool saved = saveLabelMap(labels, filename);
+    double save_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    start = std::chrono::steady_clock::now();
+    dlabelmap loaded = saved ? loadLabelMap(filename) : dlabelmap();
+    double load_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    long bytes = (long)std::ifstream(filename, std::ios::binary | std::ios::ate).tellg();
+    std::remove(filename);
+
+    bool same = loaded.width == labels.width && loaded.height == labels.height && loaded.label == labels.label &&
+                loaded.palette.size() == labels.palette.size();
+    for (size_t k = 0; same && k < labels.palette.size(); ++k) {
+        const dpixel &a = labels.palette[k];
+        const dpixel &b = loaded.palette[k];
+        same = a.R == b.R && a.G == b.G && a.B == b.B;
+    }
+    std::cout << "\nlabel map   save ms    load ms    bytes" << std::endl;
+    std::cout << std::left << std::setw(12) << labels.palette.size() << std::setw(11) << save_ms << std::setw(11)
+              << load_ms << bytes << (same ? "" : " (labels differ)") << std::endl;
+}
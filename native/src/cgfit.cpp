@@ -0,0 +1,225 @@
+/**
+ * @file cgfit.cpp
+ * @author Jupiter Westbard
+ * @date 10/18/2026
+ * @brief geometric (levenberg-marquardt) circle fitting for circlegen
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <tuple>
+#include <cmath>
+#include <limits>
+#include <random>
+
+#include <Eigen/Core>
+#include <Eigen/Dense>
+
+#include "circlegen.h"
+
+dcircle fitCircleLM(const dpointpool &pool, const dcircle &guess, int max_iterations,
+                    double *loss, int *iterations, cgstats *stats);
+void benchmarkFitters(const dpointlist &points, dpixmap *pm, int trials);
+
+// mean edge distance over the points within CG_LOSS_BAND, same as CircleOptimization
+static double meanEdgeLoss(const dpointpool &pool, const Eigen::Vector3d &c, long &evaluations, long &tests) {
+    double total_loss = 0.0;
+    int count = 0;
+    for (size_t i = 0; i < pool.active; ++i) {
+        double x = std::get<0>(pool.points[i]);
+        double y = std::get<1>(pool.points[i]);
+        double dist_edge = std::abs(std::sqrt((c(0) - x) * (c(0) - x) + (c(1) - y) * (c(1) - y)) - c(2));
+        if (dist_edge < CG_LOSS_BAND) {
+            ++count;
+            total_loss += dist_edge;
+        }
+    }
+    ++evaluations;
+    tests += pool.active;
+    return count > 0 ? total_loss / count : std::numeric_limits<double>::quiet_NaN();
+}
+
+// truncated L1 cost: sum of min(|d - r|, band) over all points. Unlike the mean
+// over a changing inlier count, it is continuous in the circle parameters
+static double truncatedCost(const dpointpool &pool, const Eigen::Vector3d &c, double band, long &evaluations, long &tests) {
+    double cost = 0.0;
+    for (size_t i = 0; i < pool.active; ++i) {
+        double x = std::get<0>(pool.points[i]);
+        double y = std::get<1>(pool.points[i]);
+        double dist_edge = std::abs(std::sqrt((c(0) - x) * (c(0) - x) + (c(1) - y) * (c(1) - y)) - c(2));
+        cost += std::min(dist_edge, band);
+    }
+    ++evaluations;
+    tests += pool.active;
+    return cost;
+}
+
+// Kasa fit: least squares on x^2 + y^2 + Dx + Ey + F = 0 over the band around
+// the guess, in coordinates centered on the inliers' mean for conditioning
+static bool kasaFit(const dpointpool &pool, const Eigen::Vector3d &guess, double band, Eigen::Vector3d &out) {
+    double mx = 0.0, my = 0.0;
+    int n = 0;
+    std::vector<int> inliers;
+    for (size_t i = 0; i < pool.active; ++i) {
+        double x = std::get<0>(pool.points[i]);
+        double y = std::get<1>(pool.points[i]);
+        double dist_edge = std::abs(std::sqrt((guess(0) - x) * (guess(0) - x) + (guess(1) - y) * (guess(1) - y)) - guess(2));
+        if (dist_edge < band) {
+            inliers.push_back((int)i);
+            mx += x;
+            my += y;
+            ++n;
+        }
+    }
+    if (n < 3) return false;
+    mx /= n;
+    my /= n;
+
+    Eigen::Matrix3d A = Eigen::Matrix3d::Zero();
+    Eigen::Vector3d b = Eigen::Vector3d::Zero();
+    for (int i : inliers) {
+        double u = std::get<0>(pool.points[i]) - mx;
+        double v = std::get<1>(pool.points[i]) - my;
+        double z = u * u + v * v;
+        Eigen::Vector3d row(u, v, 1.0);
+        A += row * row.transpose();
+        b -= row * z;
+    }
+
+    Eigen::Vector3d def = A.ldlt().solve(b);
+    double cx = -def(0) / 2.0;
+    double cy = -def(1) / 2.0;
+    double r2 = cx * cx + cy * cy - def(2);
+    if (!std::isfinite(r2) || r2 <= 0.0) return false;
+
+    out = Eigen::Vector3d(mx + cx, my + cy, std::sqrt(r2));
+    return true;
+}
+
+dcircle fitCircleLM(const dpointpool &pool, const dcircle &guess, int max_iterations,
+                    double *loss, int *iterations, cgstats *stats) {
+    long evaluations = 0;
+    long tests = 0;
+    double band = CG_LOSS_BAND;
+
+    // start from the algebraic fit only if it actually beats the guess
+    Eigen::Vector3d c(std::get<0>(guess), std::get<1>(guess), std::get<2>(guess));
+    double cost = truncatedCost(pool, c, band, evaluations, tests);
+    Eigen::Vector3d kasa;
+    if (kasaFit(pool, c, band, kasa)) {
+        double kcost = truncatedCost(pool, kasa, band, evaluations, tests);
+        if (kcost < cost) {
+            c = kasa;
+            cost = kcost;
+        }
+    }
+
+    double lambda = 1e-3;
+    int it = 0;
+    while (it < max_iterations) {
+        ++it;
+        // residuals d_i - r of the points inside the band, weighted by 1 / |res|
+        // so each least squares step is an IRLS step on the truncated L1 cost
+        Eigen::Matrix3d JtJ = Eigen::Matrix3d::Zero();
+        Eigen::Vector3d Jtr = Eigen::Vector3d::Zero();
+        for (size_t i = 0; i < pool.active; ++i) {
+            double dx = c(0) - std::get<0>(pool.points[i]);
+            double dy = c(1) - std::get<1>(pool.points[i]);
+            double d = std::sqrt(dx * dx + dy * dy);
+            double res = d - c(2);
+            if (std::abs(res) >= band || d < 1e-9) continue;
+            double w = 1.0 / std::max(std::abs(res), 1.0);
+            Eigen::Vector3d J(dx / d, dy / d, -1.0);
+            JtJ += w * J * J.transpose();
+            Jtr += w * J * res;
+        }
+        ++evaluations;
+        tests += pool.active;
+
+        // damp until the step lowers the cost, or give up
+        bool improved = false;
+        Eigen::Vector3d delta = Eigen::Vector3d::Zero();
+        for (int attempt = 0; attempt < 6 && !improved; ++attempt) {
+            Eigen::Matrix3d damped = JtJ;
+            damped.diagonal() += lambda * JtJ.diagonal();
+            delta = damped.ldlt().solve(-Jtr);
+            if (!delta.allFinite()) break;
+
+            Eigen::Vector3d next = c + delta;
+            double ncost = truncatedCost(pool, next, band, evaluations, tests);
+            if (ncost < cost) {
+                c = next;
+                cost = ncost;
+                lambda = std::max(lambda / 10.0, 1e-9);
+                improved = true;
+            }
+            else {
+                lambda *= 10.0;
+            }
+        }
+        if (!improved || delta.norm() < 1e-3) break;
+    }
+
+    double fval = meanEdgeLoss(pool, c, evaluations, tests);
+    if (stats != nullptr) {
+        stats->evaluations += evaluations;
+        stats->pointTests += tests;
+    }
+    if (loss != nullptr) *loss = fval;
+    if (iterations != nullptr) *iterations = it;
+    return std::make_tuple(c(0), c(1), c(2));
+}
+
+// number of live points within threshold of the circle's edge
+static size_t countSupport(const dpointpool &pool, const dcircle &circle, int threshold) {
+    double cx = std::get<0>(circle);
+    double cy = std::get<1>(circle);
+    double r = std::get<2>(circle);
+
+    size_t support = 0;
+    for (size_t i = 0; i < pool.active; ++i) {
+        double x = std::get<0>(pool.points[i]);
+        double y = std::get<1>(pool.points[i]);
+        double dist_center = std::sqrt((cx - x) * (cx - x) + (cy - y) * (cy - y));
+        if (std::abs(dist_center - r) <= threshold) ++support;
+    }
+    return support;
+}
+
+void benchmarkFitters(const dpointlist &points, dpixmap *pm, int trials) {
+    if (points.size() < 2) return;
+    dpointpool pool = makePointpool(points);
+
+    // same seed pairs for every fitter
+    std::mt19937 gen(12345);
+    std::uniform_int_distribution<int> dis(0, (int)points.size() - 1);
+    std::vector<dcircle> seeds;
+    for (int t = 0; t < trials; ++t) {
+        const dpoint &p1 = points[dis(gen)];
+        const dpoint &p2 = points[dis(gen)];
+        double dx = std::get<0>(p1) - std::get<0>(p2);
+        double dy = std::get<1>(p1) - std::get<1>(p2);
+        seeds.push_back(std::make_tuple((double)std::get<0>(p1), (double)std::get<1>(p1), std::sqrt(dx * dx + dy * dy)));
+    }
+
+    const char *names[] = {"gd", "gdf", "gdcpp", "lm", "dt"};
+    cgfitter fitters[] = {CG_FIT_DESCENT, CG_FIT_DESCENT_FLOAT, CG_FIT_GDCPP, CG_FIT_LM, CG_FIT_DISTANCE};
+    std::cout << "fitter    iters/fit    evals/fit    us/fit    loss      support" << std::endl;
+    for (int f = 0; f < 5; ++f) {
+        cgparams params;
+        params.fitter = fitters[f];
+        cgstats stats;
+        for (const dcircle &seed : seeds) {
+            dcircle fitted = refineCircle(pool, pm, seed, params, nullptr, &stats);
+            stats.supportSum += countSupport(pool, fitted, params.trimBand);
+        }
+        double fits = (double)std::max(1L, stats.fits);
+        std::cout << std::left << std::setw(10) << names[f] << std::fixed << std::setprecision(2)
+                  << std::setw(13) << stats.iterations / fits
+                  << std::setw(13) << stats.evaluations / fits
+                  << std::setw(10) << 1e6 * stats.fitSeconds / fits
+                  << std::setw(10) << stats.lossSum / fits
+                  << stats.supportSum / fits << std::endl;
+    }
+}
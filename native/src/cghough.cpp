@@ -0,0 +1,219 @@
+/**
+ * @file cghough.cpp
+ * @author Jupiter Westbard
+ * @date 10/18/2026
+ * @brief gradient-oriented hough circle search for circlegen
+ */
+
+#include <iostream>
+#include <vector>
+#include <tuple>
+#include <cmath>
+#include <algorithm>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "circlegen.h"
+
+std::vector<dcircle> houghCircles(dpointpool &pool, dpixmap *pm, int num, const cgparams &params, cgstats *stats);
+
+struct houghspace_ { // center accumulator, one cell per houghCell x houghCell pixels
+    int cell;
+    int width;
+    int height;
+    std::vector<int> votes;
+}; typedef struct houghspace_ houghspace;
+
+struct houghpeak_ {
+    int votes;
+    int idx;
+}; typedef struct houghpeak_ houghpeak;
+
+// every live point votes for the centers along its gradient line, in both
+// directions since the edge contrast can go either way
+static void voteCenters(const dpointpool &pool, const dgradient &grad, int rmin, int rmax, houghspace &space) {
+    int threads = 1;
+#ifdef _OPENMP
+    threads = omp_get_max_threads();
+#endif
+    size_t cells = space.votes.size();
+    std::vector<int> local(cells * threads, 0);
+
+    #pragma omp parallel
+    {
+        int thread = 0;
+#ifdef _OPENMP
+        thread = omp_get_thread_num();
+#endif
+        int *acc = &local[cells * thread];
+        double step = 0.7 * space.cell;
+
+        #pragma omp for schedule(static)
+        for (long i = 0; i < (long)pool.active; ++i) {
+            int x = std::get<0>(pool.points[i]);
+            int y = std::get<1>(pool.points[i]);
+            double gx = grad.dx[y * grad.width + x];
+            double gy = grad.dy[y * grad.width + x];
+            double mag = std::sqrt(gx * gx + gy * gy);
+            if (mag < 1.0) continue; // no usable direction
+
+            double nx = gx / mag;
+            double ny = gy / mag;
+            for (int sign = -1; sign <= 1; sign += 2) {
+                int last = -1;
+                for (double r = rmin; r <= rmax; r += step) {
+                    int ax = (int)((x + sign * nx * r) / space.cell);
+                    int ay = (int)((y + sign * ny * r) / space.cell);
+                    if (ax < 0 || ay < 0 || ax >= space.width || ay >= space.height) break;
+                    int idx = ay * space.width + ax;
+                    if (idx != last) ++acc[idx]; // one vote per cell per direction
+                    last = idx;
+                }
+            }
+        }
+
+        // reduce the per-thread accumulators
+        #pragma omp for schedule(static)
+        for (long c = 0; c < (long)cells; ++c) {
+            int sum = 0;
+            for (int t = 0; t < threads; ++t) sum += local[cells * t + c];
+            space.votes[c] = sum;
+        }
+    }
+}
+
+// local maxima of the 3x3 smoothed accumulator, strongest first
+static std::vector<houghpeak> findPeaks(const houghspace &space, int min_votes) {
+    std::vector<int> smooth(space.votes.size(), 0);
+    for (int y = 1; y < space.height - 1; ++y) {
+        for (int x = 1; x < space.width - 1; ++x) {
+            int sum = 0;
+            for (int ky = -1; ky <= 1; ++ky)
+                for (int kx = -1; kx <= 1; ++kx)
+                    sum += space.votes[(y + ky) * space.width + (x + kx)];
+            smooth[y * space.width + x] = sum;
+        }
+    }
+
+    std::vector<houghpeak> peaks;
+    for (int y = 1; y < space.height - 1; ++y) {
+        for (int x = 1; x < space.width - 1; ++x) {
+            int idx = y * space.width + x;
+            int v = smooth[idx];
+            if (v < min_votes) continue;
+            bool is_max = true;
+            for (int ky = -1; ky <= 1 && is_max; ++ky)
+                for (int kx = -1; kx <= 1; ++kx) {
+                    int n = idx + ky * space.width + kx;
+                    // ties go to the earlier cell so plateaus yield one peak
+                    if (smooth[n] > v || (smooth[n] == v && n < idx)) { is_max = false; break; }
+                }
+            if (is_max) peaks.push_back({v, idx});
+        }
+    }
+
+    std::stable_sort(peaks.begin(), peaks.end(), [](const houghpeak &a, const houghpeak &b) {
+        return a.votes > b.votes;
+    });
+    return peaks;
+}
+
+// best supported radius around a center: histogram of point distances,
+// scanned with a window as wide as the trim band
+static int estimateRadius(const dpointpool &pool, double cx, double cy, int rmin, int rmax,
+                          int band, int *support, long &tests) {
+    std::vector<int> hist(rmax + 1, 0);
+    for (size_t i = 0; i < pool.active; ++i) {
+        double dx = std::get<0>(pool.points[i]) - cx;
+        double dy = std::get<1>(pool.points[i]) - cy;
+        int d = (int)std::lround(std::sqrt(dx * dx + dy * dy));
+        if (d >= rmin && d <= rmax) ++hist[d];
+    }
+    tests += pool.active;
+
+    int half = std::max(1, band / 2);
+    int best_r = 0, best = 0;
+    int window = 0;
+    for (int r = rmin; r <= rmax; ++r) {
+        // window covers [r - half, r + half]
+        if (r == rmin) {
+            for (int k = rmin; k <= std::min(rmax, rmin + half); ++k) window += hist[k];
+        }
+        else {
+            if (r + half <= rmax) window += hist[r + half];
+            if (r - half - 1 >= rmin) window -= hist[r - half - 1];
+        }
+        if (window > best) {
+            best = window;
+            best_r = r;
+        }
+    }
+    *support = best;
+    return best_r;
+}
+
+std::vector<dcircle> houghCircles(dpointpool &pool, dpixmap *pm, int num, const cgparams &params, cgstats *stats) {
+    dgradient grad = sobelGradient(*pm);
+
+    houghspace space;
+    space.cell = std::max(1, params.houghCell);
+    space.width = pm->width / space.cell + 1;
+    space.height = pm->height / space.cell + 1;
+    space.votes.assign(space.width * space.height, 0);
+
+    int rmin = std::max(1, params.houghMinRadius);
+    int rmax = params.houghMaxRadius > 0 ? params.houghMaxRadius : std::max(pm->width, pm->height) / 2;
+
+    std::vector<dcircle> circles;
+    long tests = 0;
+
+    while ((int)circles.size() < num && pool.active > 3) {
+        if (searchExpired(params, stats)) break;
+        voteCenters(pool, grad, rmin, rmax, space);
+        std::vector<houghpeak> peaks = findPeaks(space, params.houghMinVotes);
+
+        // take the strongest peak whose points agree on a radius
+        bool found = false;
+        dcircle guess;
+        int support = 0;
+        for (const houghpeak &peak : peaks) {
+            double cx = (peak.idx % space.width + 0.5) * space.cell;
+            double cy = (peak.idx / space.width + 0.5) * space.cell;
+            int r = estimateRadius(pool, cx, cy, rmin, rmax, params.trimBand, &support, tests);
+            if (support >= params.houghMinVotes) {
+                guess = std::make_tuple(cx, cy, (double)r);
+                found = true;
+                break;
+            }
+        }
+        if (!found) break; // no peak left with enough support
+
+        double loss = 0.0;
+        dcircle fitted = refineCircle(pool, pm, guess, params, &loss, stats);
+        if (!(loss > 0)) fitted = guess; // refinement degenerated, keep the vote
+
+        circles.push_back(fitted);
+        // the voters go too: a fit that drifted off the peak would otherwise
+        // leave them behind to elect the same peak again
+        size_t removed = trimPointlist(pool, fitted, params.trimBand);
+        removed += trimPointlist(pool, guess, params.trimBand);
+        commitTrims(pool);
+        reportProgress(params, circles);
+        std::cout << "Circle found."
+                  << " Center: (" << std::get<0>(fitted) << ", " << std::get<1>(fitted) << ")"
+                  << " Radius: " << std::get<2>(fitted)
+                  << " Votes: " << support << std::endl;
+        std::cout << "Num points left: " << pool.active << std::endl;
+        if (removed == 0) break; // nothing changed, the next round would find the same peak
+    }
+
+    if (stats != nullptr) {
+        stats->pointTests += tests;
+        stats->fitsAccepted += circles.size();
+    }
+    delete[] grad.dx;
+    delete[] grad.dy;
+    return circles;
+}
@@ -0,0 +1,235 @@
+/**
+ * @file cglabels.cpp
+ * @author Jupiter Westbard
+ * @date 10/18/2026
+ * @brief label map and indexed image output for circlegen
+ */
+
+#include "circlegen.h"
+
+#include <iostream>
+#include <climits>
+#include <fstream>
+#include <string>
+#include <iterator>
+#include <unordered_map>
+
+#include <png.h>
+#include <zlib.h>
+
+#define CG_LABELMAP_VERSION 1
+#define CG_DEFLATE_RATIO 1032  // most bytes zlib inflates one compressed byte to
+
+static void putWord(std::string &out, uint32_t value) {
+    for (int k = 0; k < 4; ++k) out.push_back((char)(value >> (8 * k) & 0xFF));
+}
+
+static void putVarint(std::string &out, uint32_t value) {
+    while (value >= 0x80) {
+        out.push_back((char)((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    out.push_back((char)value);
+}
+
+static bool getWord(const std::string &in, size_t &pos, uint32_t &value) {
+    if (pos + 4 > in.size()) return false;
+    value = 0;
+    for (int k = 0; k < 4; ++k) value |= (uint32_t)(unsigned char)in[pos++] << (8 * k);
+    return true;
+}
+
+static bool getVarint(const std::string &in, size_t &pos, uint32_t &value) {
+    value = 0;
+    for (int shift = 0; shift < 35 && pos < in.size(); shift += 7) {
+        unsigned char byte = in[pos++];
+        value |= (uint32_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+bool saveLabelMap(const dlabelmap &labels, const char *filename) {
+    std::string out = "CGLM";
+    putWord(out, CG_LABELMAP_VERSION);
+    putWord(out, (uint32_t)labels.width);
+    putWord(out, (uint32_t)labels.height);
+    putWord(out, (uint32_t)labels.palette.size());
+    for (const dpixel &color : labels.palette) {
+        out.push_back((char)color.R);
+        out.push_back((char)color.G);
+        out.push_back((char)color.B);
+    }
+
+    // regions are large and convex-ish, so a row is a few long runs, and a
+    // run mostly starts on the label of the pixel above it (coded as 0).
+    // Neighboring rows repeat most of their runs, which deflate picks up
+    std::string runs;
+    size_t pixels = labels.label.size();
+    for (size_t i = 0; i < pixels;) {
+        size_t end = i + 1;
+        while (end < pixels && labels.label[end] == labels.label[i]) ++end;
+        putVarint(runs, (uint32_t)(end - i));
+        bool above = i >= (size_t)labels.width && labels.label[i - labels.width] == labels.label[i];
+        putVarint(runs, above ? 0 : labels.label[i] + 1);
+        i = end;
+    }
+    uLongf packed_size = compressBound(runs.size());
+    std::string packed(packed_size, '\0');
+    if (compress2((Bytef *)&packed[0], &packed_size, (const Bytef *)runs.data(), runs.size(),
+                  Z_BEST_COMPRESSION) != Z_OK) {
+        std::cerr << "Error: Could not compress label map " << filename << std::endl;
+        return false;
+    }
+    putWord(out, (uint32_t)runs.size());
+    putWord(out, (uint32_t)packed_size);
+    out.append(packed, 0, packed_size);
+
+    std::ofstream file(filename, std::ios::binary);
+    if (!file || !file.write(out.data(), out.size())) {
+        std::cerr << "Error: Could not write label map " << filename << std::endl;
+        return false;
+    }
+    return true;
+}
+
+dlabelmap loadLabelMap(const char *filename) {
+    dlabelmap empty = {0, 0, std::vector<uint32_t>(), std::vector<dpixel>()};
+    std::ifstream file(filename, std::ios::binary);
+    if (!file) {
+        std::cerr << "Error: Could not open label map " << filename << std::endl;
+        return empty;
+    }
+    std::string in((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    size_t pos = 4;
+    uint32_t version, width, height, colors, runs_size, packed_size;
+    if (in.compare(0, 4, "CGLM") != 0 || !getWord(in, pos, version) || version != CG_LABELMAP_VERSION ||
+        !getWord(in, pos, width) || !getWord(in, pos, height) || !getWord(in, pos, colors) ||
+        width == 0 || height == 0 || width > INT_MAX || height > INT_MAX || pos + 3 * (size_t)colors > in.size()) {
+        std::cerr << "Error: " << filename << " is not a label map" << std::endl;
+        return empty;
+    }
+
+    dlabelmap labels = {(int)width, (int)height, std::vector<uint32_t>(), std::vector<dpixel>(colors)};
+    for (dpixel &color : labels.palette) {
+        color.R = (unsigned char)in[pos++];
+        color.G = (unsigned char)in[pos++];
+        color.B = (unsigned char)in[pos++];
+    }
+
+    std::string runs;
+    uLongf unpacked_size = 0;
+    // a run stream longer than the packed bytes can inflate to is corrupt
+    if (getWord(in, pos, runs_size) && getWord(in, pos, packed_size) && pos + packed_size <= in.size() &&
+        runs_size <= (size_t)packed_size * CG_DEFLATE_RATIO) {
+        runs.resize(runs_size);
+        unpacked_size = runs_size;
+        if (uncompress((Bytef *)&runs[0], &unpacked_size, (const Bytef *)&in[pos], packed_size) != Z_OK) {
+            unpacked_size = 0;
+        }
+    }
+    if (unpacked_size != runs_size || runs_size == 0) {
+        std::cerr << "Error: " << filename << " has corrupt labels" << std::endl;
+        return empty;
+    }
+
+    // the runs must cover exactly width x height pixels before any of them are allocated
+    size_t pixels = (size_t)width * height;
+    size_t covered = 0;
+    pos = 0;
+    while (covered < pixels) {
+        uint32_t length, code;
+        if (!getVarint(runs, pos, length) || !getVarint(runs, pos, code) || length == 0 || length > pixels - covered ||
+            code > colors || (code == 0 && covered < width)) {
+            std::cerr << "Error: " << filename << " has corrupt labels" << std::endl;
+            return empty;
+        }
+        covered += length;
+    }
+    if (pos != runs.size()) {
+        std::cerr << "Error: " << filename << " has corrupt labels" << std::endl;
+        return empty;
+    }
+
+    labels.label.reserve(pixels);
+    pos = 0;
+    while (labels.label.size() < pixels) {
+        uint32_t length, code;
+        size_t start = labels.label.size();
+        getVarint(runs, pos, length);
+        getVarint(runs, pos, code);
+        uint32_t label = code == 0 ? labels.label[start - width] : code - 1;
+        labels.label.insert(labels.label.end(), length, label);
+    }
+    return labels;
+}
+
+// one png row of a label map: palette indices, or RGB without an index
+static void labelRow(const dlabelmap &labels, int y, const std::vector<uint8_t> &index, png_byte *row) {
+    const uint32_t *label = &labels.label[(size_t)y * labels.width];
+    for (int x = 0; x < labels.width; ++x) {
+        if (!index.empty()) {
+            row[x] = index[label[x]];
+            continue;
+        }
+        const dpixel &c = labels.palette[label[x]];
+        row[3 * x] = (png_byte)c.R;
+        row[3 * x + 1] = (png_byte)c.G;
+        row[3 * x + 2] = (png_byte)c.B;
+    }
+}
+
+bool saveIndexedImage(const dlabelmap &labels, const char *filename) {
+    // regions sharing a color share an index
+    std::unordered_map<uint32_t, uint8_t> indices;
+    std::vector<uint8_t> index(labels.palette.size());
+    std::vector<png_color> colors;
+    for (size_t k = 0; k < labels.palette.size() && colors.size() <= 256; ++k) {
+        const dpixel &c = labels.palette[k];
+        uint32_t rgb = (uint32_t)c.R << 16 | (uint32_t)c.G << 8 | (uint32_t)c.B;
+        auto found = indices.emplace(rgb, (uint8_t)colors.size());
+        if (found.second) colors.push_back({(png_byte)c.R, (png_byte)c.G, (png_byte)c.B});
+        index[k] = found.first->second;
+    }
+    if (colors.size() > 256) {
+        std::cout << "More than 256 fill colors, writing '" << filename << "' as RGB" << std::endl;
+        index.clear();
+    }
+
+    FILE *fp = fopen(filename, "wb");
+    if (!fp) {
+        std::cerr << "Error: Could not open PNG file " << filename << std::endl;
+        return false;
+    }
+    png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    png_infop info = png ? png_create_info_struct(png) : nullptr;
+    if (!info) {
+        png_destroy_write_struct(&png, (png_infopp)NULL);
+        fclose(fp);
+        std::cerr << "Error: Could not create PNG write struct" << std::endl;
+        return false;
+    }
+    std::vector<png_byte> row(labels.width * 3);
+    if (setjmp(png_jmpbuf(png))) {
+        png_destroy_write_struct(&png, &info);
+        fclose(fp);
+        std::cerr << "Error: Error during PNG encoding" << std::endl;
+        return false;
+    }
+
+    png_init_io(png, fp);
+    png_set_IHDR(png, info, labels.width, labels.height, 8,
+                 index.empty() ? PNG_COLOR_TYPE_RGB : PNG_COLOR_TYPE_PALETTE,
+                 PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+    if (!index.empty()) png_set_PLTE(png, info, colors.data(), (int)colors.size());
+    png_write_info(png, info);
+    for (int y = 0; y < labels.height; ++y) {
+        labelRow(labels, y, index, row.data());
+        png_write_row(png, row.data());
+    }
+    png_write_end(png, NULL);
+    png_destroy_write_struct(&png, &info);
+    fclose(fp);
+    return true;
+}
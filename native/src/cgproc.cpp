@@ -11,19 +11,68 @@
 #include <cmath>
 #include <random>
 #include <algorithm>
+#include <chrono>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #include <Eigen/Core>
 #include "gdcpp.h"
+#include "cgdescent.h"
+#include "cgdistance.h"
 
 #include "circlegen.h"
 
+struct fitmonitor_ { // early-abort state for one descent
+    double bound;       // loss the fit has to reach, <= 0 disables aborting
+    long budget;        // iteration cap of the descent
+    int warmup;
+    double first;
+    double best;
+    bool aborted;
+    const dcirclecache *cache; // known basins, may be null
+    long lookups;
+    bool known;         // stopped on a cached circle
+    const cgdeadline *deadline; // may be null
+    bool expired;       // stopped by the deadline
+}; typedef struct fitmonitor_ fitmonitor;
+
 bool equalCircles(const dcircle &lhs, const dcircle &rhs, double epsilon);
 static void set_pixel(dpixel *pixel, double val);
 static double mag_factor(dpixel pixel);
 dpixmap sobelFilter(dpixmap pm);
+dgradient sobelGradient(const dpixmap &pm);
 dpointlist samplePoints(dpixmap pm, int num, double threshold);
-dpointlist trimPointlist(dpointlist &pointlist, const dcircle &circle, int threshold);
+dpointpool makePointpool(dpointlist points);
+size_t trimPointlist(dpointpool &pool, const dcircle &circle, int threshold);
+void rollbackTrim(dpointpool &pool);
+void commitTrims(dpointpool &pool);
+void mergeStats(cgstats *into, const cgstats &from);
+cgdeadline makeDeadline(double seconds, const std::atomic<bool> *cancel);
+bool deadlineExpired(const cgdeadline *deadline);
+bool searchExpired(const cgparams &params, cgstats *stats);
+void reportProgress(const cgparams &params, const std::vector<dcircle> &circles);
+bool findCircle(const dcirclecache &cache, const dcircle &circle, dcacheentry *entry);
+void rememberCircle(dcirclecache &cache, const dcircle &circle, bool accepted);
+void forgetRejected(dcirclecache &cache);
+dcircle refineCircle(const dpointpool &pool, dpixmap *pm, const dcircle &guess,
+                     const cgparams &params, double *loss, cgstats *stats,
+                     const dcirclecache *cache);
+static dcircle descendCircle(const dpointpool &pool, dpixmap *pm, const dcircle &guess,
+                             fitmonitor *monitor, double *loss, int *iterations, cgstats *stats);
+template<typename Scalar>
+static dcircle descendCircleFixed(const dpointpool &pool, dpixmap *pm, const dcircle &guess,
+                                  fitmonitor *monitor, double *loss, int *iterations, cgstats *stats);
+static dcircle descendDistance(const dpointpool &pool, dpixmap *pm, const dcircle &guess, const cgparams &params,
+                               fitmonitor *monitor, double *loss, int *iterations, cgstats *stats);
+dcircle seedCircle(const dpointpool &pool, const dgradient *grad, cgseeding seeding, std::mt19937 &gen);
+static void trimClaimed(dpointpool &pool, const std::vector<char> &claimed);
+static std::vector<dcircle> roundCircles(dpointpool &pool, dpixmap *pm, int num,
+                                         const cgparams &params, cgstats *stats);
 std::vector<dcircle> generateCircles(dpointlist &pointlist, dpixmap *pm, int num);
+std::vector<dcircle> generateCircles(dpointlist &pointlist, dpixmap *pm, int num,
+                                     const cgparams &params, cgstats *stats);
 
 bool equalCircles(const dcircle &lhs, const dcircle &rhs, double epsilon) { // for debugging
     return abs(std::get<0>(lhs) - std::get<0>(rhs)) < epsilon &&
@@ -42,25 +91,34 @@ static double mag_factor(dpixel pixel) {
     return (255.0 - mag) / 255.0;
 }
 
-struct CircleOptimization {
-    static dpixmap *dpm;
-    static dpointlist dpl;
-    static dcircle last;
+struct CircleOptimization { // per thread state, so fits can run in parallel
+    static thread_local dpixmap *dpm;
+    static thread_local const dpoint *dpl; // live points of the pool, not a copy
+    static thread_local size_t dpl_size;
+    static thread_local dcircle last;
+    static thread_local long evaluations;
+    static thread_local long pointTests;
 
     CircleOptimization() { 
         last = std::make_tuple(0.0, 0.0, 0.0);
     }
 
-    static void initialize(dpointlist &points, dpixmap *pixmap) {
+    static void initialize(const dpointpool &pool, dpixmap *pixmap) {
         dpm = pixmap;
-        dpl = points;
+        dpl = pool.points.data();
+        dpl_size = pool.active;
     }
 
-    double operator()(const Eigen::VectorXd &params, Eigen::VectorXd &) const {
+    // templated on the vector type so gdcpp (Eigen::VectorXd) and CircleDescent
+    // (fixed 3-vectors, float or double) share the same loss
+    template<typename Vector>
+    typename Vector::Scalar operator()(const Vector &params, Vector &) const {
+        typedef typename Vector::Scalar Scalar;
+
         /* BREAKPOINT: first display circles, then update last */
         // dcircle current_circle = std::make_tuple(params(0), params(1), params(2));
         // dcircle last_circle = last;
-        // dpointlist current_pointlist = dpl;
+        // dpointlist current_pointlist(dpl, dpl + dpl_size);
 
         // if (!equalCircles(current_circle, last_circle, 0.1)) {
         //     breakpointSaveImage(dpm, current_pointlist, current_circle, last_circle);
@@ -70,31 +128,37 @@ struct CircleOptimization {
         // }
 
         /* continue optimization */
-        double total_loss = 0.0;
-        double cx = params(0);
-        double cy = params(1);
-        double r = params(2);
+        ++evaluations;
+        pointTests += dpl_size;
+        Scalar total_loss = 0;
+        Scalar cx = params(0);
+        Scalar cy = params(1);
+        Scalar r = params(2);
 
         int count = 0;
-        for (const auto &point : dpl) {
-            double x = std::get<0>(point);
-            double y = std::get<1>(point);
-            double dist_center = std::sqrt((cx - x) * (cx - x) + (cy - y) * (cy - y));
-            double dist_edge = std::abs(dist_center - r);
-            if (dist_edge < 150) {
+        for (size_t i = 0; i < dpl_size; ++i) {
+            const dpoint &point = dpl[i];
+            Scalar x = std::get<0>(point);
+            Scalar y = std::get<1>(point);
+            Scalar dist_center = std::sqrt((cx - x) * (cx - x) + (cy - y) * (cy - y));
+            Scalar dist_edge = std::abs(dist_center - r);
+            if (dist_edge < Scalar(CG_LOSS_BAND)) {
                 ++count;
                 total_loss += dist_edge;
             }
         }
 
-        return total_loss / (double)count;
+        return total_loss / (Scalar)count;
     }
 };
 
 // Define static members of CircleOptimization
-dpixmap* CircleOptimization::dpm = nullptr;
-dpointlist CircleOptimization::dpl;
-dcircle CircleOptimization::last = std::make_tuple(0.0, 0.0, 0.0);
+thread_local dpixmap* CircleOptimization::dpm = nullptr;
+thread_local const dpoint* CircleOptimization::dpl = nullptr;
+thread_local size_t CircleOptimization::dpl_size = 0;
+thread_local dcircle CircleOptimization::last = std::make_tuple(0.0, 0.0, 0.0);
+thread_local long CircleOptimization::evaluations = 0;
+thread_local long CircleOptimization::pointTests = 0;
 
 dpixmap sobelFilter(dpixmap pm) {
     dpixmap filtered = {pm.width, pm.height, new dpixel[pm.width * pm.height]};
@@ -136,6 +200,32 @@ dpixmap sobelFilter(dpixmap pm) {
     return filtered;
 }
 
+dgradient sobelGradient(const dpixmap &pm) {
+    int width = pm.width;
+    int height = pm.height;
+    dgradient grad = {width, height, new float[width * height](), new float[width * height]()};
+
+    // same kernels as sobelFilter, keeping the signed components. sobelFilter's
+    // Gy points up; here y grows downwards like the pixel rows, so (dx, dy)
+    // is the intensity gradient in image coordinates
+    #pragma omp parallel for schedule(static)
+    for (int y = 1; y < height - 1; ++y) {
+        for (int x = 1; x < width - 1; ++x) {
+            const dpixel *up = &pm.data[(y - 1) * width + x];
+            const dpixel *mid = &pm.data[y * width + x];
+            const dpixel *down = &pm.data[(y + 1) * width + x];
+
+            int sumX = -up[-1].R + up[1].R - 2 * mid[-1].R + 2 * mid[1].R - down[-1].R + down[1].R;
+            int sumY = down[-1].R + 2 * down[0].R + down[1].R - up[-1].R - 2 * up[0].R - up[1].R;
+
+            grad.dx[y * width + x] = (float)sumX;
+            grad.dy[y * width + x] = (float)sumY;
+        }
+    }
+
+    return grad;
+}
+
 dpointlist samplePoints(dpixmap pm, int num, double threshold) {
     dpointlist points;
 
@@ -160,32 +250,194 @@ dpointlist samplePoints(dpixmap pm, int num, double threshold) {
     return points;
 }
 
-dpointlist trimPointlist(dpointlist &pointlist, const dcircle &circle, int threshold) {
-    dpointlist trimmed;
+// process-wide, so a pool freed and reallocated at the same address still
+// looks new to caches keyed on its identity
+static std::atomic<uint64_t> pool_identities(1);
+
+dpointpool makePointpool(dpointlist points) {
+    size_t active = points.size();
+    return {std::move(points), active, std::vector<size_t>(), pool_identities++, pool_identities++};
+}
+
+size_t trimPointlist(dpointpool &pool, const dcircle &circle, int threshold) {
     double cx = std::get<0>(circle);
     double cy = std::get<1>(circle);
     double r = std::get<2>(circle);
-    
-    for (const auto &point : pointlist) {
-        double x = std::get<0>(point);
-        double y = std::get<1>(point);
+
+    // partition [0, active) so kept points stay in front; removed ones end up
+    // in [active, old active) where rollbackTrim can find them again
+    size_t kept = 0;
+    for (size_t i = 0; i < pool.active; ++i) {
+        double x = std::get<0>(pool.points[i]);
+        double y = std::get<1>(pool.points[i]);
         double dist_center = std::sqrt((cx - x) * (cx - x) + (cy - y) * (cy - y));
         double dist_edge = std::abs(dist_center - r);
         if (dist_edge > threshold) {
-            trimmed.push_back(point);
+            std::swap(pool.points[kept++], pool.points[i]);
         }
     }
-    
-    return trimmed;
+
+    size_t removed = pool.active - kept;
+    pool.marks.push_back(pool.active);
+    pool.active = kept;
+    pool.generation = pool_identities++;
+    return removed;
+}
+
+void rollbackTrim(dpointpool &pool) {
+    if (pool.marks.empty()) return;
+    pool.active = pool.marks.back();
+    pool.marks.pop_back();
+    pool.generation = pool_identities++;
+}
+
+void commitTrims(dpointpool &pool) {
+    pool.marks.clear();
+}
+
+void mergeStats(cgstats *into, const cgstats &from) {
+    if (into == nullptr) return;
+    into->evaluations += from.evaluations;
+    into->pointTests += from.pointTests;
+    into->fits += from.fits;
+    into->iterations += from.iterations;
+    into->fitSeconds += from.fitSeconds;
+    into->lossSum += from.lossSum;
+    into->supportSum += from.supportSum;
+    into->fitsAborted += from.fitsAborted;
+    into->fitsAccepted += from.fitsAccepted;
+    into->rateStopped = into->rateStopped || from.rateStopped;
+    into->cacheLookups += from.cacheLookups;
+    into->cacheHits += from.cacheHits;
+    into->rounds += from.rounds;
+    into->coarseFits += from.coarseFits;
+    into->coarseSeconds += from.coarseSeconds;
+    into->truncated = into->truncated || from.truncated;
+}
+
+cgdeadline makeDeadline(double seconds, const std::atomic<bool> *cancel) {
+    cgdeadline deadline = {seconds > 0, std::chrono::steady_clock::now(), cancel};
+    if (deadline.bounded) {
+        deadline.end += std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(seconds));
+    }
+    return deadline;
+}
+
+bool deadlineExpired(const cgdeadline *deadline) {
+    if (deadline == nullptr) return false;
+    if (deadline->cancel != nullptr && deadline->cancel->load(std::memory_order_relaxed)) return true;
+    return deadline->bounded && std::chrono::steady_clock::now() >= deadline->end;
+}
+
+bool searchExpired(const cgparams &params, cgstats *stats) {
+    if (!deadlineExpired(params.deadline)) return false;
+    if (stats != nullptr) stats->truncated = true;
+    return true;
 }
 
+void reportProgress(const cgparams &params, const std::vector<dcircle> &circles) {
+    if (params.progress != nullptr) params.progress(circles, params.progressData);
+}
+
+static long long cacheKey(long long qx, long long qy, long long qr) {
+    return (qx * 73856093LL) ^ (qy * 19349663LL) ^ (qr * 83492791LL);
+}
+
+bool findCircle(const dcirclecache &cache, const dcircle &circle, dcacheentry *entry) {
+    if (cache.buckets.empty()) return false;
+    long long qx = (long long)std::floor(std::get<0>(circle) / cache.tolerance);
+    long long qy = (long long)std::floor(std::get<1>(circle) / cache.tolerance);
+    long long qr = (long long)std::floor(std::get<2>(circle) / cache.tolerance);
+
+    // a match within tolerance lies in this bucket or a neighbor
+    for (int dx = -1; dx <= 1; ++dx)
+        for (int dy = -1; dy <= 1; ++dy)
+            for (int dr = -1; dr <= 1; ++dr) {
+                auto it = cache.buckets.find(cacheKey(qx + dx, qy + dy, qr + dr));
+                if (it == cache.buckets.end()) continue;
+                for (const dcacheentry &e : it->second) {
+                    if (equalCircles(e.circle, circle, cache.tolerance)) {
+                        if (entry != nullptr) *entry = e;
+                        return true;
+                    }
+                }
+            }
+    return false;
+}
+
+void rememberCircle(dcirclecache &cache, const dcircle &circle, bool accepted) {
+    long long qx = (long long)std::floor(std::get<0>(circle) / cache.tolerance);
+    long long qy = (long long)std::floor(std::get<1>(circle) / cache.tolerance);
+    long long qr = (long long)std::floor(std::get<2>(circle) / cache.tolerance);
+    cache.buckets[cacheKey(qx, qy, qr)].push_back({circle, accepted});
+}
+
+void forgetRejected(dcirclecache &cache) {
+    for (auto it = cache.buckets.begin(); it != cache.buckets.end();) {
+        std::vector<dcacheentry> &entries = it->second;
+        entries.erase(std::remove_if(entries.begin(), entries.end(),
+                                     [](const dcacheentry &e) { return !e.accepted; }),
+                      entries.end());
+        if (entries.empty()) it = cache.buckets.erase(it);
+        else ++it;
+    }
+}
+
+// descent callback: stops a trajectory once it reaches a circle already in the
+// cache, or once extrapolating its recent progress over the remaining
+// iterations can't bring the loss under the bound
+struct FitCallback {
+    fitmonitor *monitor = nullptr;
+
+    template<typename Vector, typename Scalar>
+    bool operator()(long iteration, const Vector &xval, Scalar fval, const Vector &) const {
+        if (monitor == nullptr) return true;
+        fitmonitor &m = *monitor;
+
+        if (deadlineExpired(m.deadline)) {
+            m.expired = true;
+            return false;
+        }
+        // the first iterates are still near the seed, not in a basin yet
+        if (m.cache != nullptr && iteration >= 2) {
+            ++m.lookups;
+            if (findCircle(*m.cache, std::make_tuple((double)xval(0), (double)xval(1), (double)xval(2)), nullptr)) {
+                m.known = true;
+                return false;
+            }
+        }
+        if (m.bound <= 0) return true;
+
+        double f = fval;
+        if (!std::isfinite(f)) { // no points left in the band
+            m.aborted = true;
+            return false;
+        }
+        if (iteration == 0) m.first = m.best = f;
+        if (f < m.best) m.best = f;
+        if (iteration + 1 < std::max(m.warmup, 2)) return true;
+
+        // BB steps aren't monotone, so extrapolate the average progress since
+        // the start rather than the last step
+        double rate = (m.first - m.best) / iteration;
+        long remaining = m.budget - iteration - 1;
+        double projected = m.best - rate * remaining;
+        if (projected > m.bound) {
+            m.aborted = true;
+            return false;
+        }
+        return true;
+    }
+};
+
 static gdc::GradientDescent<double, CircleOptimization,
-    gdc::BarzilaiBorwein<double>> makeOptimizer() {
+    gdc::BarzilaiBorwein<double>, FitCallback> makeOptimizer(int maxIterations) {
 
     gdc::GradientDescent<double, CircleOptimization,
-        gdc::BarzilaiBorwein<double>> optimizer;
+        gdc::BarzilaiBorwein<double>, FitCallback> optimizer;
     
-    optimizer.setMaxIterations(40);
+    optimizer.setMaxIterations(maxIterations);
     optimizer.setMinGradientLength(0.06);
     optimizer.setMinStepLength(1e-9);
     optimizer.setVerbosity(0);
@@ -193,51 +445,482 @@ static gdc::GradientDescent<double, CircleOptimization,
     return optimizer;
 }
 
-std::vector<dcircle> generateCircles(dpointlist &pointlist, dpixmap *pm, int num) {
+// allocation-free counterpart of makeOptimizer, same settings
+template<typename Scalar>
+static CircleDescent<Scalar, CircleOptimization, FitCallback> makeCircleDescent(int maxIterations) {
+    CircleDescent<Scalar, CircleOptimization, FitCallback> optimizer;
+
+    optimizer.setMaxIterations(maxIterations);
+    optimizer.setMinGradientLength(static_cast<Scalar>(0.06));
+    optimizer.setMinStepLength(static_cast<Scalar>(1e-9));
+
+    return optimizer;
+}
+
+dcircle refineCircle(const dpointpool &pool, dpixmap *pm, const dcircle &guess,
+                     const cgparams &params, double *loss, cgstats *stats,
+                     const dcirclecache *cache) {
+    auto start = std::chrono::steady_clock::now();
+    dcircle fitted;
+    double fval = 0.0;
+    int iterations = 0;
+    fitmonitor monitor = {params.acceptLoss, params.maxIterations, params.abortWarmup, 0.0, 0.0, false,
+                          cache, 0, false, params.deadline, false};
+
+    switch (params.fitter) {
+    case CG_FIT_LM:
+        fitted = fitCircleLM(pool, guess, params.lmIterations, &fval, &iterations, stats);
+        break;
+    case CG_FIT_DISTANCE:
+        fitted = descendDistance(pool, pm, guess, params, &monitor, &fval, &iterations, stats);
+        break;
+    case CG_FIT_GDCPP:
+        fitted = descendCircle(pool, pm, guess, &monitor, &fval, &iterations, stats);
+        break;
+    case CG_FIT_DESCENT_FLOAT:
+        fitted = descendCircleFixed<float>(pool, pm, guess, &monitor, &fval, &iterations, stats);
+        break;
+    case CG_FIT_DESCENT:
+    default:
+        fitted = descendCircleFixed<double>(pool, pm, guess, &monitor, &fval, &iterations, stats);
+        break;
+    }
+
+    if (stats != nullptr) {
+        ++stats->fits;
+        stats->iterations += iterations;
+        stats->fitSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (std::isfinite(fval)) stats->lossSum += fval;
+        if (monitor.aborted) ++stats->fitsAborted;
+        stats->cacheLookups += monitor.lookups;
+        if (monitor.known) ++stats->cacheHits;
+        if (monitor.expired) stats->truncated = true;
+    }
+    if (monitor.aborted || monitor.known || monitor.expired) fval = std::nan("");
+    if (loss != nullptr) *loss = fval;
+    return fitted;
+}
+
+static dcircle descendCircle(const dpointpool &pool, dpixmap *pm, const dcircle &guess,
+                             fitmonitor *monitor, double *loss, int *iterations, cgstats *stats) {
+    Eigen::VectorXd initialGuess(3);
+    initialGuess(0) = std::get<0>(guess);
+    initialGuess(1) = std::get<1>(guess);
+    initialGuess(2) = std::get<2>(guess);
+
+    auto opt = makeOptimizer(monitor->budget);
+    CircleOptimization::initialize(pool, pm);
+    CircleOptimization circleOpt;
+    opt.setObjective(circleOpt);
+    FitCallback callback;
+    callback.monitor = monitor;
+    opt.setCallback(callback);
+
+    long evaluations = CircleOptimization::evaluations;
+    long tests = CircleOptimization::pointTests;
+    auto result = opt.minimize(initialGuess);
+
+    if (stats != nullptr) {
+        stats->evaluations += CircleOptimization::evaluations - evaluations;
+        stats->pointTests += CircleOptimization::pointTests - tests;
+    }
+    *loss = result.fval;
+    *iterations = result.iterations;
+    return std::make_tuple(result.xval(0), result.xval(1), result.xval(2));
+}
+
+template<typename Scalar>
+static dcircle descendCircleFixed(const dpointpool &pool, dpixmap *pm, const dcircle &guess,
+                                  fitmonitor *monitor, double *loss, int *iterations, cgstats *stats) {
+    typename CircleDescent<Scalar, CircleOptimization, FitCallback>::Vector initialGuess(
+        static_cast<Scalar>(std::get<0>(guess)),
+        static_cast<Scalar>(std::get<1>(guess)),
+        static_cast<Scalar>(std::get<2>(guess)));
+
+    auto opt = makeCircleDescent<Scalar>(monitor->budget);
+    CircleOptimization::initialize(pool, pm);
+    CircleOptimization circleOpt;
+    opt.setObjective(circleOpt);
+    FitCallback callback;
+    callback.monitor = monitor;
+    opt.setCallback(callback);
+
+    long evaluations = CircleOptimization::evaluations;
+    long tests = CircleOptimization::pointTests;
+    auto result = opt.minimize(initialGuess);
+
+    if (stats != nullptr) {
+        stats->evaluations += CircleOptimization::evaluations - evaluations;
+        stats->pointTests += CircleOptimization::pointTests - tests;
+    }
+    *loss = result.fval;
+    *iterations = result.iterations;
+    return std::make_tuple((double)result.xval(0), (double)result.xval(1), (double)result.xval(2));
+}
+
+static dcircle descendDistance(const dpointpool &pool, dpixmap *pm, const dcircle &guess, const cgparams &params,
+                               fitmonitor *monitor, double *loss, int *iterations, cgstats *stats) {
+    std::shared_ptr<const ddistmap> map = edgeDistanceMap(pool, pm, params);
+    DistanceOptimization::map = map.get();
+    DistanceOptimization distOpt;
+    distOpt.band = 2.0 * params.trimBand; // a narrow band keeps far edges from pulling the fit away
+    distOpt.spacing = params.distSpacing;
+    distOpt.minRadius = params.distMinRadius;
+
+    CircleDescent<double, DistanceOptimization, FitCallback> opt;
+    opt.setMaxIterations(monitor->budget);
+    // the mean of unit edge slopes around a circle is much flatter than the point loss
+    opt.setMinGradientLength(1e-3);
+    opt.setMinStepLength(1e-9);
+    opt.setMaxStepLength(params.trimBand); // BB overshoots on plateaus of the truncated distance
+    opt.setAnalyticGradient(true);
+    opt.setObjective(distOpt);
+    FitCallback callback;
+    callback.monitor = monitor;
+    opt.setCallback(callback);
+
+    long evaluations = DistanceOptimization::evaluations;
+    long samples = DistanceOptimization::samples;
+    CircleDescent<double, DistanceOptimization, FitCallback>::Vector initialGuess(
+        std::get<0>(guess), std::get<1>(guess), std::get<2>(guess));
+    auto result = opt.minimize(initialGuess);
+
+    if (stats != nullptr) {
+        stats->evaluations += DistanceOptimization::evaluations - evaluations;
+        stats->pointTests += DistanceOptimization::samples - samples;
+    }
+    DistanceOptimization::map = nullptr; // map is released on return
+    // like the point loss, a circle with nothing within the band has no loss
+    *loss = DistanceOptimization::inside > 0 ? result.fval : std::nan("");
+    *iterations = result.iterations;
+    return std::make_tuple(result.xval(0), result.xval(1), result.xval(2));
+}
+
+// unit gradient normal at a point, false where the gradient is too weak to trust
+static bool pointNormal(const dgradient &grad, const dpoint &p, double &nx, double &ny) {
+    int x = std::get<0>(p);
+    int y = std::get<1>(p);
+    if (x < 0 || y < 0 || x >= grad.width || y >= grad.height) return false;
+    double gx = grad.dx[y * grad.width + x];
+    double gy = grad.dy[y * grad.width + x];
+    double mag = std::sqrt(gx * gx + gy * gy);
+    if (mag < 1.0) return false;
+    nx = gx / mag;
+    ny = gy / mag;
+    return true;
+}
+
+dcircle seedCircle(const dpointpool &pool, const dgradient *grad, cgseeding seeding, std::mt19937 &gen) {
+    std::uniform_int_distribution<int> dis(0, (int)pool.active - 1);
+    const dpoint &p1 = pool.points[dis(gen)];
+    const dpoint &p2 = pool.points[dis(gen)];
+    double x1 = std::get<0>(p1), y1 = std::get<1>(p1);
+    double x2 = std::get<0>(p2), y2 = std::get<1>(p2);
+
+    double nx1, ny1;
+    if (seeding != CG_SEED_RANDOM && grad != nullptr && pointNormal(*grad, p1, nx1, ny1)) {
+        double limit = std::max(grad->width, grad->height);
+
+        if (seeding == CG_SEED_PAIR) {
+            // intersect p1 + t1 n1 with q + t2 n2; both edge points sit on the
+            // circle only if they are about equally far from the crossing
+            for (int attempt = 0; attempt < 8; ++attempt) {
+                const dpoint &q = pool.points[dis(gen)];
+                double nx2, ny2;
+                if (!pointNormal(*grad, q, nx2, ny2)) continue;
+                double det = nx1 * (-ny2) - ny1 * (-nx2);
+                if (std::abs(det) < 0.1) continue; // nearly parallel normals
+                double bx = std::get<0>(q) - x1;
+                double by = std::get<1>(q) - y1;
+                double t1 = (bx * (-ny2) - by * (-nx2)) / det;
+                double t2 = (nx1 * by - ny1 * bx) / det;
+                double r1 = std::abs(t1), r2 = std::abs(t2);
+                if (std::abs(r1 - r2) > 0.2 * std::max(r1, r2) || r1 > limit) continue;
+                return std::make_tuple(x1 + t1 * nx1, y1 + t1 * ny1, (r1 + r2) / 2.0);
+            }
+        }
+
+        // the circle centered on p1's normal line that passes through p2
+        double dx = x2 - x1;
+        double dy = y2 - y1;
+        double along = dx * nx1 + dy * ny1;
+        if (std::abs(along) > 1e-6) {
+            double t = (dx * dx + dy * dy) / (2.0 * along);
+            if (std::abs(t) <= limit) {
+                return std::make_tuple(x1 + t * nx1, y1 + t * ny1, std::abs(t));
+            }
+        }
+    }
+
+    // p1 == center, p2 == edge
+    return std::make_tuple(x1, y1, std::sqrt((x1 - x2) * (x1 - x2) + (y1 - y2) * (y1 - y2)));
+}
+
+static std::vector<dcircle> descentCircles(dpointpool &pool, dpixmap *pm, int num,
+                                           const cgparams &params, cgstats *stats) {
     std::random_device rd;
     std::mt19937 gen(rd());
-    std::uniform_int_distribution<int> dis;
 
     std::vector<dcircle> circles;
+    dgradient grad = {0, 0, nullptr, nullptr};
+    if (params.seeding != CG_SEED_RANDOM) grad = sobelGradient(*pm);
+
+    cgparams local = params;       // carries the adaptive iteration budget
+    cgstats fit_stats;
+    double accepted_iterations = 0.0;
+    std::vector<bool> outcomes;    // ring buffer of the last rateWindow attempts
+    int window_accepts = 0;
+    long attempts = 0;
+    dcirclecache cache = {params.dedupTolerance, {}};
+    const dcirclecache *known = params.dedupTolerance > 0 ? &cache : nullptr;
 
     int fail_count = 0;
     while (true) {
-        if (circles.size() >= num || pointlist.size() <= 3 || fail_count > 100) {
-            return circles;
-        }
-        // pick 2 random points from pointlist
-        dis = std::uniform_int_distribution<int>(0, pointlist.size() - 1);
-        dpoint p1 = pointlist[dis(gen)];
-        dpoint p2 = pointlist[dis(gen)];
-
-        // p1 == center, p2 == edge
-        double cx = std::get<0>(p1);
-        double cy = std::get<1>(p1);
-        double r = std::sqrt((std::get<0>(p1) - std::get<0>(p2)) * (std::get<0>(p1) - std::get<0>(p2)) +
-                             (std::get<1>(p1) - std::get<1>(p2)) * (std::get<1>(p1) - std::get<1>(p2)));
-        
-        Eigen::VectorXd initialGuess(3);
-        initialGuess(0) = cx;
-        initialGuess(1) = cy;
-        initialGuess(2) = r;
-
-        auto opt = makeOptimizer();
-        CircleOptimization::initialize(pointlist, pm);
-        CircleOptimization circleOpt;
-        opt.setObjective(circleOpt);
-
-        auto result = opt.minimize(initialGuess);
-
-        if (result.fval && result.fval > 0) {
-            circles.push_back(std::make_tuple(result.xval(0), result.xval(1), result.xval(2)));
+        if (circles.size() >= num || pool.active <= 3 || fail_count > 100) {
+            break;
+        }
+        if (searchExpired(params, &fit_stats)) {
+            break;
+        }
+        if (params.acceptLoss > 0 && params.rateWindow > 0 && attempts >= params.rateWindow &&
+            window_accepts < params.minAcceptRate * params.rateWindow) {
+            // acceptance rate collapsed: the remaining points don't hold circles
+            // tight enough for acceptLoss
+            fit_stats.rateStopped = true;
+            break;
+        }
+        dcircle guess = seedCircle(pool, grad.dx != nullptr ? &grad : nullptr, params.seeding, gen);
+
+        double loss = 0.0;
+        long iterations = fit_stats.iterations;
+        long hits = fit_stats.cacheHits;
+        dcircle fitted = refineCircle(pool, pm, guess, local, &loss, &fit_stats, known);
+        iterations = fit_stats.iterations - iterations;
+
+        bool accepted = loss && loss > 0 && (params.acceptLoss <= 0 || loss <= params.acceptLoss);
+        if (known != nullptr && fit_stats.cacheHits == hits && std::isfinite(loss)) {
+            rememberCircle(cache, fitted, accepted);
+        }
+        if (params.rateWindow > 0) {
+            if (outcomes.size() < (size_t)params.rateWindow) outcomes.push_back(accepted);
+            else {
+                window_accepts -= outcomes[attempts % params.rateWindow];
+                outcomes[attempts % params.rateWindow] = accepted;
+            }
+            window_accepts += accepted;
+        }
+        ++attempts;
+
+        if (accepted) {
+            ++fit_stats.fitsAccepted;
+            if (params.adaptiveBudget && params.acceptLoss > 0) {
+                // budget 1.5x the running mean of what accepted fits needed
+                accepted_iterations += (iterations - accepted_iterations) / fit_stats.fitsAccepted;
+                local.maxIterations = std::max(params.abortWarmup + 3,
+                    std::min(params.maxIterations, (int)std::ceil(1.5 * accepted_iterations) + 2));
+            }
+            circles.push_back(fitted);
             dcircle &new_circle = circles.back();
-            pointlist = trimPointlist(pointlist, new_circle, 20);
+            trimPointlist(pool, new_circle, params.trimBand);
+            commitTrims(pool);
+            forgetRejected(cache); // the trimmed pool can turn rejected basins into circles
+            reportProgress(params, circles);
             std::cout << "Circle found." 
                       << " Center: (" << std::get<0>(new_circle) << ", " << std::get<1>(new_circle) << ")"
                       << " Radius: " << std::get<2>(new_circle) << std::endl;
-            std::cout << "Num points left: " << pointlist.size() << std::endl;
+            std::cout << "Num points left: " << pool.active << std::endl;
             fail_count = 0;
         }
         else { ++fail_count; }
     }
+
+    mergeStats(stats, fit_stats);
+    delete[] grad.dx;
+    delete[] grad.dy;
+    return circles;
+}
+
+struct roundfit_ { // one speculative fit of a round
+    dcircle circle;
+    double loss;
+    bool accepted;
+    bool known;                    // stopped on a cached circle
+    std::vector<size_t> inliers;   // live points within trimBand, as pool indices
+}; typedef struct roundfit_ roundfit;
+
+// one partition pass for all circles accepted in a round, like trimPointlist
+static void trimClaimed(dpointpool &pool, const std::vector<char> &claimed) {
+    // claimed is indexed by the positions of the snapshot; that stays valid
+    // because the swaps never touch positions the loop has not reached yet
+    size_t kept = 0;
+    for (size_t i = 0; i < pool.active; ++i) {
+        if (!claimed[i]) {
+            std::swap(pool.points[kept++], pool.points[i]);
+        }
+    }
+    pool.marks.push_back(pool.active);
+    pool.active = kept;
+    pool.generation = pool_identities++;
+}
+
+static std::vector<dcircle> roundCircles(dpointpool &pool, dpixmap *pm, int num,
+                                         const cgparams &params, cgstats *stats) {
+    std::random_device rd;
+    unsigned base_seed = rd();
+
+    std::vector<dcircle> circles;
+    dgradient grad = {0, 0, nullptr, nullptr};
+    if (params.seeding != CG_SEED_RANDOM) grad = sobelGradient(*pm);
+    dcirclecache cache = {params.dedupTolerance, {}};
+    const dcirclecache *known = params.dedupTolerance > 0 ? &cache : nullptr;
+
+    cgstats fit_stats;
+    std::vector<roundfit> fits(params.roundSize);
+    int fail_count = 0;
+    while ((int)circles.size() < num && pool.active > 3 && fail_count <= 100) {
+        if (searchExpired(params, &fit_stats)) break;
+        ++fit_stats.rounds;
+
+        // every seed of the round is fitted against the same snapshot of the pool
+        #pragma omp parallel
+        {
+            cgstats thread_stats;
+
+            #pragma omp for schedule(dynamic)
+            for (int k = 0; k < params.roundSize; ++k) {
+                std::mt19937 gen(base_seed + 7919u * (unsigned)(fit_stats.rounds * params.roundSize + k));
+                roundfit &fit = fits[k];
+                dcircle guess = seedCircle(pool, grad.dx != nullptr ? &grad : nullptr, params.seeding, gen);
+                long hits = thread_stats.cacheHits;
+                fit.circle = refineCircle(pool, pm, guess, params, &fit.loss, &thread_stats, known);
+                fit.known = thread_stats.cacheHits != hits;
+                fit.accepted = fit.loss && fit.loss > 0 && (params.acceptLoss <= 0 || fit.loss <= params.acceptLoss);
+
+                fit.inliers.clear();
+                if (!fit.accepted) continue;
+                double cx = std::get<0>(fit.circle);
+                double cy = std::get<1>(fit.circle);
+                double r = std::get<2>(fit.circle);
+                for (size_t i = 0; i < pool.active; ++i) {
+                    double x = std::get<0>(pool.points[i]);
+                    double y = std::get<1>(pool.points[i]);
+                    if (std::abs(std::sqrt((cx - x) * (cx - x) + (cy - y) * (cy - y)) - r) <= params.trimBand) {
+                        fit.inliers.push_back(i);
+                    }
+                }
+            }
+
+            #pragma omp critical
+            mergeStats(&fit_stats, thread_stats);
+        }
+
+        // best supported first; a candidate only counts if most of its inliers
+        // are not already claimed by a circle accepted earlier in the round
+        std::vector<int> order;
+        for (int k = 0; k < params.roundSize; ++k) {
+            if (known != nullptr && !fits[k].known && std::isfinite(fits[k].loss)) {
+                rememberCircle(cache, fits[k].circle, fits[k].accepted);
+            }
+            if (fits[k].accepted && !fits[k].inliers.empty()) order.push_back(k);
+        }
+        std::stable_sort(order.begin(), order.end(), [&fits](int a, int b) {
+            return fits[a].inliers.size() > fits[b].inliers.size();
+        });
+
+        std::vector<char> claimed(pool.active, 0);
+        int accepted = 0;
+        for (int k : order) {
+            if ((int)circles.size() >= num) break;
+            const roundfit &fit = fits[k];
+            size_t overlap = 0;
+            for (size_t i : fit.inliers) overlap += claimed[i];
+            if (overlap > params.roundOverlap * fit.inliers.size()) continue;
+
+            for (size_t i : fit.inliers) claimed[i] = 1;
+            circles.push_back(fit.circle);
+            ++accepted;
+            reportProgress(params, circles);
+            std::cout << "Circle found."
+                      << " Center: (" << std::get<0>(fit.circle) << ", " << std::get<1>(fit.circle) << ")"
+                      << " Radius: " << std::get<2>(fit.circle)
+                      << " Support: " << fit.inliers.size() << std::endl;
+        }
+        fit_stats.fitsAccepted += accepted;
+
+        if (accepted == 0) {
+            fail_count += params.roundSize;
+            continue;
+        }
+        fail_count = 0;
+        trimClaimed(pool, claimed);
+        commitTrims(pool);
+        forgetRejected(cache);
+        std::cout << "Num points left: " << pool.active << std::endl;
+    }
+
+    mergeStats(stats, fit_stats);
+    delete[] grad.dx;
+    delete[] grad.dy;
+    return circles;
+}
+
+struct progressrelay_ { // reports an engine's circles after the ones the pyramid found
+    const std::vector<dcircle> *found;
+    cgprogress progress;
+    void *user;
+}; typedef struct progressrelay_ progressrelay;
+
+static void relayProgress(const std::vector<dcircle> &circles, void *user) {
+    const progressrelay *relay = (const progressrelay *)user;
+    std::vector<dcircle> all = *relay->found;
+    all.insert(all.end(), circles.begin(), circles.end());
+    relay->progress(all, relay->user);
+}
+
+std::vector<dcircle> generateCircles(dpointlist &pointlist, dpixmap *pm, int num) {
+    return generateCircles(pointlist, pm, num, cgparams(), nullptr);
+}
+
+std::vector<dcircle> generateCircles(dpointlist &pointlist, dpixmap *pm, int num,
+                                     const cgparams &params, cgstats *stats) {
+    // fit against an in-place pool; hand the survivors back when done
+    dpointpool pool = makePointpool(std::move(pointlist));
+
+    // the pyramid finds what it can coarsely; the engine searches the
+    // full resolution points for the rest
+    std::vector<dcircle> circles;
+    if (params.pyramidWidth > 0 && pm->width / 2 >= params.pyramidWidth) {
+        circles = pyramidCircles(pool, pm, num, params, stats);
+    }
+    int rest = num - (int)circles.size();
+
+    cgparams engine = params;
+    progressrelay relay = {&circles, params.progress, params.progressData};
+    if (params.progress != nullptr && !circles.empty()) {
+        engine.progress = relayProgress;
+        engine.progressData = &relay;
+    }
+
+    std::vector<dcircle> found;
+    switch (params.engine) {
+    case CG_ENGINE_RANSAC:
+        if (rest > 0) found = ransacCircles(pool, rest, engine, stats);
+        break;
+    case CG_ENGINE_HOUGH:
+        if (rest > 0) found = houghCircles(pool, pm, rest, engine, stats);
+        break;
+    case CG_ENGINE_BATCH:
+        if (rest > 0) found = batchCircles(pool, pm, rest, engine, stats);
+        break;
+    case CG_ENGINE_DESCENT:
+    default:
+        if (rest > 0 && params.roundSize > 0) found = roundCircles(pool, pm, rest, engine, stats);
+        else if (rest > 0) found = descentCircles(pool, pm, rest, engine, stats);
+        break;
+    }
+    circles.insert(circles.end(), found.begin(), found.end());
+
+    pool.points.resize(pool.active);
+    pointlist = std::move(pool.points);
+    return circles;
 }
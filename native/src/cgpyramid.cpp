@@ -0,0 +1,150 @@
+/**
+ * @file cgpyramid.cpp
+ * @author Jupiter Westbard
+ * @date 10/18/2026
+ * @brief coarse-to-fine circle fitting over an image pyramid for circlegen
+ */
+
+#include <iostream>
+#include <vector>
+#include <tuple>
+#include <cmath>
+#include <chrono>
+#include <algorithm>
+
+#include "circlegen.h"
+
+std::vector<dcircle> pyramidCircles(dpointpool &pool, dpixmap *pm, int num, const cgparams &params, cgstats *stats);
+
+struct pyramidlevel_ {
+    dpixmap image;
+    dpixmap edges;  // sobelFilter of image
+    double scale;   // image width / full resolution width
+}; typedef struct pyramidlevel_ pyramidlevel;
+
+// 2x2 box average. Unlike a bilinear jitteredResample to half the width,
+// every source pixel contributes, so thin edges survive the octave
+static dpixmap halveImage(const dpixmap &pm) {
+    int width = pm.width / 2;
+    int height = pm.height / 2;
+    dpixmap half = {width, height, new dpixel[width * height]};
+
+    for (int y = 0; y < height; ++y) {
+        const dpixel *top = &pm.data[(2 * y) * pm.width];
+        const dpixel *bottom = &pm.data[(2 * y + 1) * pm.width];
+        for (int x = 0; x < width; ++x) {
+            dpixel &p = half.data[y * width + x];
+            p.R = (top[2 * x].R + top[2 * x + 1].R + bottom[2 * x].R + bottom[2 * x + 1].R + 2) / 4;
+            p.G = (top[2 * x].G + top[2 * x + 1].G + bottom[2 * x].G + bottom[2 * x + 1].G + 2) / 4;
+            p.B = (top[2 * x].B + top[2 * x + 1].B + bottom[2 * x].B + bottom[2 * x + 1].B + 2) / 4;
+        }
+    }
+    return half;
+}
+
+// halve the image until the next octave would drop below min_width; returned
+// coarsest first, without the full resolution image itself
+static std::vector<pyramidlevel> buildPyramid(const dpixmap &pm, int min_width) {
+    std::vector<pyramidlevel> levels;
+    const dpixmap *finer = &pm;
+    while (finer->width / 2 >= min_width && finer->height / 2 >= 3) {
+        dpixmap image = halveImage(*finer);
+        levels.push_back({image, sobelFilter(image), (double)image.width / pm.width});
+        finer = &levels.back().image;
+    }
+
+    std::reverse(levels.begin(), levels.end());
+    return levels;
+}
+
+static dcircle scaleCircle(const dcircle &circle, double factor) {
+    return std::make_tuple(std::get<0>(circle) * factor, std::get<1>(circle) * factor,
+                           std::get<2>(circle) * factor);
+}
+
+// the full resolution trim band measured in pixels of a level
+static cgparams levelParams(const cgparams &params, double scale) {
+    cgparams level = params;
+    level.trimBand = std::max(2, (int)std::lround(params.trimBand * scale));
+    level.pyramidWidth = 0;
+    level.progress = nullptr; // only full resolution circles are reported
+    return level;
+}
+
+// a few descent iterations per circle against one point set, each circle
+// claiming its points before the next one is refined
+static void refineOnPool(dpointpool &pool, dpixmap *pm, std::vector<dcircle> &circles, std::vector<bool> &found,
+                         const cgparams &params, cgstats *stats) {
+    std::vector<dcircle> refined_so_far;
+    for (size_t k = 0; k < circles.size(); ++k) {
+        if (searchExpired(params, stats)) continue; // out of time: keep the estimate of the coarser level
+        if (pool.active <= 3) {
+            found[k] = false;
+            continue;
+        }
+        double loss;
+        dcircle refined = refineCircle(pool, pm, circles[k], params, &loss, stats);
+        found[k] = loss && loss > 0 && (params.acceptLoss <= 0 || loss <= params.acceptLoss);
+        if (!found[k]) continue;
+        circles[k] = refined;
+        trimPointlist(pool, refined, params.trimBand);
+        commitTrims(pool);
+        refined_so_far.push_back(refined);
+        reportProgress(params, refined_so_far);
+    }
+}
+
+// Circles are searched for with the selected engine on the coarsest level,
+// where a small point set covers the large circles that dominate the
+// output. Each finer level only refines them with params.pyramidIterations
+// descent iterations, so the full resolution work is a fixed, small number
+// of iterations per circle. Circles that fail to refine on a finer level
+// keep their last estimate, except on the full resolution pool where they
+// are dropped.
+std::vector<dcircle> pyramidCircles(dpointpool &pool, dpixmap *pm, int num, const cgparams &params, cgstats *stats) {
+    auto start = std::chrono::steady_clock::now();
+    std::vector<pyramidlevel> levels = buildPyramid(*pm, params.pyramidWidth);
+    if (levels.empty()) return {};
+
+    cgstats coarse_stats;
+    pyramidlevel &coarse = levels[0];
+    dpointlist coarse_points = samplePoints(coarse.edges, params.pyramidPoints, params.edgeThreshold);
+    std::cout << "Pyramid: " << levels.size() << " levels, searching " << coarse.image.width << "x"
+              << coarse.image.height << " with " << coarse_points.size() << " points" << std::endl;
+    std::vector<dcircle> circles = generateCircles(coarse_points, &coarse.image, num,
+                                                   levelParams(params, coarse.scale), &coarse_stats);
+    std::vector<bool> found(circles.size(), true);
+
+    cgparams refine = params;
+    refine.maxIterations = params.pyramidIterations;
+    refine.adaptiveBudget = false;
+    for (size_t l = 1; l < levels.size(); ++l) {
+        for (dcircle &circle : circles) circle = scaleCircle(circle, levels[l].scale / levels[l - 1].scale);
+        dpointlist points = samplePoints(levels[l].edges, params.pyramidPoints, params.edgeThreshold);
+        dpointpool level_pool = makePointpool(std::move(points));
+        refineOnPool(level_pool, &levels[l].image, circles, found, levelParams(refine, levels[l].scale),
+                     &coarse_stats);
+    }
+    coarse_stats.coarseFits = coarse_stats.fits;
+    coarse_stats.coarseSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    mergeStats(stats, coarse_stats);
+
+    for (dcircle &circle : circles) circle = scaleCircle(circle, 1.0 / levels.back().scale);
+    refineOnPool(pool, pm, circles, found, refine, stats);
+
+    std::vector<dcircle> accepted;
+    for (size_t k = 0; k < circles.size(); ++k) {
+        if (!found[k]) continue;
+        accepted.push_back(circles[k]);
+        std::cout << "Circle refined."
+                  << " Center: (" << std::get<0>(circles[k]) << ", " << std::get<1>(circles[k]) << ")"
+                  << " Radius: " << std::get<2>(circles[k]) << std::endl;
+    }
+    if (stats != nullptr) stats->fitsAccepted += (long)accepted.size() - coarse_stats.fitsAccepted;
+
+    for (pyramidlevel &level : levels) {
+        delete[] level.image.data;
+        delete[] level.edges.data;
+    }
+    return accepted;
+}
@@ -0,0 +1,227 @@
+/**
+ * @file cgransac.cpp
+ * @author Jupiter Westbard
+ * @date 10/18/2026
+ * @brief RANSAC circle search for circlegen
+ */
+
+#include <iostream>
+#include <vector>
+#include <tuple>
+#include <cmath>
+#include <random>
+#include <algorithm>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "circlegen.h"
+
+std::vector<dcircle> ransacCircles(dpointpool &pool, int num, const cgparams &params, cgstats *stats);
+
+struct pointgrid_ { // uniform bucket grid over the live points
+    double cell;
+    int minx, miny;
+    int cols, rows;
+    std::vector<int> start; // cell c holds order[start[c] .. start[c + 1])
+    std::vector<int> order; // pool indices grouped by cell
+}; typedef struct pointgrid_ pointgrid;
+
+struct hypothesis_ {
+    dcircle circle;
+    int support;
+}; typedef struct hypothesis_ hypothesis;
+
+static int cellOf(const pointgrid &grid, int col, int row) {
+    return row * grid.cols + col;
+}
+
+static pointgrid buildGrid(const dpointpool &pool, double cell) {
+    pointgrid grid;
+    grid.cell = cell;
+
+    int minx = std::get<0>(pool.points[0]), maxx = minx;
+    int miny = std::get<1>(pool.points[0]), maxy = miny;
+    for (size_t i = 1; i < pool.active; ++i) {
+        minx = std::min(minx, std::get<0>(pool.points[i]));
+        maxx = std::max(maxx, std::get<0>(pool.points[i]));
+        miny = std::min(miny, std::get<1>(pool.points[i]));
+        maxy = std::max(maxy, std::get<1>(pool.points[i]));
+    }
+    grid.minx = minx;
+    grid.miny = miny;
+    grid.cols = (int)((maxx - minx) / cell) + 1;
+    grid.rows = (int)((maxy - miny) / cell) + 1;
+
+    // counting sort of the point indices by cell
+    std::vector<int> cells(pool.active);
+    grid.start.assign(grid.cols * grid.rows + 1, 0);
+    for (size_t i = 0; i < pool.active; ++i) {
+        int col = (int)((std::get<0>(pool.points[i]) - minx) / cell);
+        int row = (int)((std::get<1>(pool.points[i]) - miny) / cell);
+        cells[i] = cellOf(grid, col, row);
+        ++grid.start[cells[i] + 1];
+    }
+    for (size_t c = 1; c < grid.start.size(); ++c) {
+        grid.start[c] += grid.start[c - 1];
+    }
+    grid.order.resize(pool.active);
+    std::vector<int> fill(grid.start.begin(), grid.start.end() - 1);
+    for (size_t i = 0; i < pool.active; ++i) {
+        grid.order[fill[cells[i]]++] = (int)i;
+    }
+    return grid;
+}
+
+// draw a point from the 3x3 cell neighborhood around p, or any point if it is empty
+static int drawNeighbor(const pointgrid &grid, const dpoint &p, std::mt19937 &gen) {
+    int col = (int)((std::get<0>(p) - grid.minx) / grid.cell);
+    int row = (int)((std::get<1>(p) - grid.miny) / grid.cell);
+    std::uniform_int_distribution<int> offset(-1, 1);
+
+    for (int attempt = 0; attempt < 4; ++attempt) {
+        int c = col + offset(gen);
+        int r = row + offset(gen);
+        if (c < 0 || r < 0 || c >= grid.cols || r >= grid.rows) continue;
+        int cell = cellOf(grid, c, r);
+        int count = grid.start[cell + 1] - grid.start[cell];
+        if (count == 0) continue;
+        std::uniform_int_distribution<int> pick(0, count - 1);
+        return grid.order[grid.start[cell] + pick(gen)];
+    }
+    std::uniform_int_distribution<int> any(0, (int)grid.order.size() - 1);
+    return grid.order[any(gen)];
+}
+
+// closed form circle through three points; false if they are (nearly) collinear
+static bool circumcircle(const dpoint &a, const dpoint &b, const dpoint &c, dcircle &out) {
+    double ax = std::get<0>(a), ay = std::get<1>(a);
+    double bx = std::get<0>(b), by = std::get<1>(b);
+    double cx = std::get<0>(c), cy = std::get<1>(c);
+
+    double d = 2.0 * (ax * (by - cy) + bx * (cy - ay) + cx * (ay - by));
+    if (std::abs(d) < 1e-6) return false;
+
+    double a2 = ax * ax + ay * ay;
+    double b2 = bx * bx + by * by;
+    double c2 = cx * cx + cy * cy;
+    double ux = (a2 * (by - cy) + b2 * (cy - ay) + c2 * (ay - by)) / d;
+    double uy = (a2 * (cx - bx) + b2 * (ax - cx) + c2 * (bx - ax)) / d;
+    double r = std::sqrt((ax - ux) * (ax - ux) + (ay - uy) * (ay - uy));
+
+    out = std::make_tuple(ux, uy, r);
+    return true;
+}
+
+// count the points within band of the circle's edge. Bails out with -1 as soon
+// as the remaining points can no longer beat the best support seen so far.
+static int scoreSupport(const dpointpool &pool, const dcircle &circle, double band, int best, long &tests) {
+    double cx = std::get<0>(circle);
+    double cy = std::get<1>(circle);
+    double r = std::get<2>(circle);
+
+    int support = 0;
+    size_t n = pool.active;
+    for (size_t i = 0; i < n; ++i) {
+        double x = std::get<0>(pool.points[i]);
+        double y = std::get<1>(pool.points[i]);
+        double dist_edge = std::abs(std::sqrt((cx - x) * (cx - x) + (cy - y) * (cy - y)) - r);
+        if (dist_edge <= band) {
+            ++support;
+        }
+        else if (support + (int)(n - i - 1) <= best) {
+            tests += i + 1;
+            return -1;
+        }
+    }
+    tests += n;
+    return support;
+}
+
+// score one batch of hypotheses in parallel and return the best of them
+static hypothesis ransacBatch(const dpointpool &pool, const pointgrid &grid, const cgparams &params,
+                              double max_radius, unsigned seed, long &evaluations, long &tests) {
+    hypothesis best = {std::make_tuple(0.0, 0.0, 0.0), -1};
+    long batch_evaluations = 0;
+    long batch_tests = 0;
+
+    #pragma omp parallel reduction(+:batch_evaluations, batch_tests)
+    {
+        int thread = 0;
+#ifdef _OPENMP
+        thread = omp_get_thread_num();
+#endif
+        std::mt19937 gen(seed + 7919 * thread);
+        std::uniform_int_distribution<int> any(0, (int)pool.active - 1);
+        hypothesis local = {std::make_tuple(0.0, 0.0, 0.0), -1};
+
+        #pragma omp for schedule(static)
+        for (int h = 0; h < params.ransacBatch; ++h) {
+            const dpoint &p1 = pool.points[any(gen)];
+            const dpoint &p2 = pool.points[drawNeighbor(grid, p1, gen)];
+            const dpoint &p3 = pool.points[drawNeighbor(grid, p1, gen)];
+
+            dcircle circle;
+            if (!circumcircle(p1, p2, p3, circle)) continue;
+            if (std::get<2>(circle) < params.trimBand || std::get<2>(circle) > max_radius) continue;
+
+            ++batch_evaluations;
+            int support = scoreSupport(pool, circle, params.trimBand, local.support, batch_tests);
+            if (support > local.support) {
+                local.circle = circle;
+                local.support = support;
+            }
+        }
+
+        #pragma omp critical
+        {
+            if (local.support > best.support) best = local;
+        }
+    }
+
+    evaluations += batch_evaluations;
+    tests += batch_tests;
+    return best;
+}
+
+std::vector<dcircle> ransacCircles(dpointpool &pool, int num, const cgparams &params, cgstats *stats) {
+    std::random_device rd;
+    std::mt19937 gen(rd());
+
+    std::vector<dcircle> circles;
+    long evaluations = 0;
+    long tests = 0;
+
+    while ((int)circles.size() < num && pool.active > 3) {
+        if (searchExpired(params, stats)) break;
+        pointgrid grid = buildGrid(pool, params.ransacNeighborhood);
+        double max_radius = 2.0 * std::max(grid.cols, grid.rows) * grid.cell;
+
+        hypothesis best = {std::make_tuple(0.0, 0.0, 0.0), -1};
+        for (int batch = 0; batch < params.ransacBatches; ++batch) {
+            if (batch > 0 && searchExpired(params, stats)) break;
+            hypothesis found = ransacBatch(pool, grid, params, max_radius, gen(), evaluations, tests);
+            if (found.support > best.support) best = found;
+            if (best.support >= params.ransacMinSupport) break;
+        }
+        if (best.support < params.ransacMinSupport) break; // no circle left with enough support
+
+        circles.push_back(best.circle);
+        trimPointlist(pool, best.circle, params.trimBand);
+        commitTrims(pool);
+        reportProgress(params, circles);
+        std::cout << "Circle found."
+                  << " Center: (" << std::get<0>(best.circle) << ", " << std::get<1>(best.circle) << ")"
+                  << " Radius: " << std::get<2>(best.circle)
+                  << " Support: " << best.support << std::endl;
+        std::cout << "Num points left: " << pool.active << std::endl;
+    }
+
+    if (stats != nullptr) {
+        stats->evaluations += evaluations;
+        stats->pointTests += tests;
+        stats->fitsAccepted += circles.size();
+    }
+    return circles;
+}
@@ -12,7 +12,7 @@
 
 #include <cairo.h>
 
-void saveImage(dpixmap pm, dpointlist *points, std::vector<dcircle> &circles) {
+void saveImage(dpixmap pm, dpointlist *points, std::vector<dcircle> &circles, const char *filename) {
     cairo_surface_t *surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, pm.width, pm.height);
     cairo_t *cr = cairo_create(surface);
 
@@ -50,7 +50,7 @@ void saveImage(dpixmap pm, dpointlist *points, std::vector<dcircle> &circles) {
         cairo_stroke(cr);
     }
 
-    cairo_surface_write_to_png(surface, "output.png");
+    cairo_surface_write_to_png(surface, filename);
     cairo_destroy(cr);
     cairo_surface_destroy(surface);
 }
@@ -0,0 +1,208 @@
+/**
+ * @file cgscale.cpp
+ * @author Jupiter Westbard
+ * @date 10/18/2026
+ * @brief output at any resolution from the fitted circles and fill colors for circlegen
+ */
+
+#include <iostream>
+#include <cmath>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+
+#include <png.h>
+
+#include "circlegen.h"
+
+#define CG_SCALE_BAND 64       // output rows rendered in parallel before they are written
+#define CG_OUTLINE_SHADE 26    // saveImage's outline color, 0.1 of full scale
+
+struct dscalesethash_ {
+    size_t operator()(const std::vector<uint64_t> &set) const {
+        uint64_t h = 0x9E3779B97F4A7C15ULL;
+        for (uint64_t word : set) h = (h ^ word) * 0x100000001B3ULL;
+        return std::hash<uint64_t>()(h);
+    }
+};
+
+typedef std::unordered_map<std::vector<uint64_t>, uint32_t, dscalesethash_> dsetlabels;
+
+// where each circle starts and stops covering a row, sorted. Pixel x of the
+// row sits at (x + shift) / scale; v is the row in circle coordinates
+static void rowEvents(const std::vector<dcircle> &circles, double v, double scale, double shift, int width,
+                      std::vector<std::pair<int, size_t>> &events) {
+    events.clear();
+    for (size_t i = 0; i < circles.size(); ++i) {
+        double dy = v - std::get<1>(circles[i]);
+        double r = std::get<2>(circles[i]);
+        if (!(std::abs(dy) < r)) continue;
+        double h = std::sqrt(r * r - dy * dy);
+        double cx = std::get<0>(circles[i]);
+        int x0 = std::max(0, (int)std::floor(scale * (cx - h) - shift) + 1);
+        int x1 = std::min(width, (int)std::ceil(scale * (cx + h) - shift));
+        if (x0 >= x1) continue;
+        events.push_back(std::make_pair(x0, i));
+        events.push_back(std::make_pair(x1, i));
+    }
+    std::sort(events.begin(), events.end());
+}
+
+// calls run(x0, x1, set) for the pixels of a row inside the same circles
+template <typename Run>
+static void rowRuns(const std::vector<std::pair<int, size_t>> &events, int width, std::vector<uint64_t> &set,
+                    Run run) {
+    std::fill(set.begin(), set.end(), 0);
+    size_t e = 0;
+    for (int x = 0; x < width;) {
+        for (; e < events.size() && events[e].first == x; ++e) {
+            set[events[e].second / 64] ^= 1ULL << events[e].second % 64;
+        }
+        int next = e < events.size() ? events[e].first : width;
+        run(x, next, set);
+        x = next;
+    }
+}
+
+// the label of every set of circles the fill colored, from the middle of
+// the longest run the label map has for it. The fill tests pixel x at x
+// itself and in float, so the pixels at the ends of a run can disagree with
+// these spans
+static dsetlabels setLabels(const std::vector<dcircle> &circles, const dlabelmap &labels) {
+    std::unordered_map<std::vector<uint64_t>, std::pair<int, uint32_t>, dscalesethash_> longest;
+    std::vector<std::pair<int, size_t>> events;
+    std::vector<uint64_t> set((circles.size() + 63) / 64);
+    for (int y = 0; y < labels.height; ++y) {
+        rowEvents(circles, y, 1.0, 0.0, labels.width, events);
+        const uint32_t *row = &labels.label[(size_t)y * labels.width];
+        rowRuns(events, labels.width, set, [&](int x0, int x1, const std::vector<uint64_t> &run) {
+            std::pair<int, uint32_t> &best = longest[run];
+            if (x1 - x0 > best.first) best = std::make_pair(x1 - x0, row[(x0 + x1) / 2]);
+        });
+    }
+
+    dsetlabels found;
+    for (const auto &set_run : longest) found.emplace(set_run.first, set_run.second.second);
+    return found;
+}
+
+// one output row: the fill color of every run of pixels, then the outlines
+// blended over it by the fraction of each pixel a line of the given width
+// covers, measured from the pixel center
+static void scaledRow(const std::vector<dcircle> &circles, const dlabelmap &labels, const dsetlabels &set_labels,
+                      double scale, int width, int y, std::vector<std::pair<int, size_t>> &events,
+                      std::vector<uint64_t> &set, png_byte *row) {
+    double v = (y + 0.5) / scale;
+    int source_y = std::min(labels.height - 1, (int)v);
+    rowEvents(circles, v, scale, 0.5, width, events);
+    rowRuns(events, width, set, [&](int x0, int x1, const std::vector<uint64_t> &run) {
+        auto found = set_labels.find(run);
+        for (int x = x0; x < x1; ++x) {
+            // sets the working resolution never saw take the label under them
+            uint32_t label = found != set_labels.end()
+                                 ? found->second
+                                 : labels.label[(size_t)source_y * labels.width +
+                                                std::min(labels.width - 1, (int)((x + 0.5) / scale))];
+            const dpixel &c = labels.palette[label];
+            row[3 * x] = (png_byte)c.R;
+            row[3 * x + 1] = (png_byte)c.G;
+            row[3 * x + 2] = (png_byte)c.B;
+        }
+    });
+
+    double line = scale; // saveImage's 1 px outlines
+    double reach = 0.5 * line + 0.5;
+    double py = y + 0.5;
+    for (const dcircle &circle : circles) {
+        double cx = scale * std::get<0>(circle);
+        double cy = scale * std::get<1>(circle);
+        double r = scale * std::get<2>(circle);
+        double dy = py - cy;
+        if (!(std::abs(dy) < r + reach)) continue;
+        double outer = std::sqrt((r + reach) * (r + reach) - dy * dy);
+        double inner = r - reach > std::abs(dy) ? std::sqrt((r - reach) * (r - reach) - dy * dy) : 0.0;
+        // the left and right pieces of the ring, one piece at the top and bottom
+        double pieces[2][2] = {{cx - outer, cx - inner}, {cx + inner, cx + outer}};
+        if (inner == 0.0) pieces[0][1] = pieces[1][0] = cx;
+        int done = -1; // pixels both pieces reach are blended once
+        for (const auto &piece : pieces) {
+            int x0 = std::max(done + 1, (int)std::floor(piece[0]));
+            int x1 = std::min(width - 1, (int)std::ceil(piece[1]));
+            for (int x = x0; x <= x1; ++x) {
+                double dx = x + 0.5 - cx;
+                double coverage = std::min(std::min(line, 1.0), reach - std::abs(std::sqrt(dx * dx + dy * dy) - r));
+                if (coverage <= 0.0) continue;
+                for (int k = 0; k < 3; ++k) {
+                    png_byte &c = row[3 * x + k];
+                    c = (png_byte)std::lround(c + coverage * (CG_OUTLINE_SHADE - c));
+                }
+            }
+            done = std::max(done, x1);
+        }
+    }
+}
+
+bool saveScaledImage(const std::vector<dcircle> &circles, const dlabelmap &labels, double scale,
+                     const char *filename) {
+    // range check in double before rounding: libpng's size limits are far
+    // below INT_MAX, and NaN or infinite scales fail every comparison
+    double scaled_width = labels.width * scale;
+    double scaled_height = labels.height * scale;
+    if (!(scaled_width >= 0.5 && scaled_width < PNG_USER_WIDTH_MAX + 0.5) ||
+        !(scaled_height >= 0.5 && scaled_height < PNG_USER_HEIGHT_MAX + 0.5) || labels.palette.empty()) {
+        std::cerr << "Error: Could not scale a " << labels.width << "x" << labels.height << " fill by " << scale
+                  << std::endl;
+        return false;
+    }
+    int width = (int)std::lround(scaled_width);
+    int height = (int)std::lround(scaled_height);
+    dsetlabels set_labels = setLabels(circles, labels);
+
+    FILE *fp = fopen(filename, "wb");
+    if (!fp) {
+        std::cerr << "Error: Could not open PNG file " << filename << std::endl;
+        return false;
+    }
+    png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    png_infop info = png ? png_create_info_struct(png) : nullptr;
+    if (!info) {
+        png_destroy_write_struct(&png, (png_infopp)NULL);
+        fclose(fp);
+        std::cerr << "Error: Could not create PNG write struct" << std::endl;
+        return false;
+    }
+    std::vector<png_byte> band((size_t)CG_SCALE_BAND * width * 3);
+    if (setjmp(png_jmpbuf(png))) {
+        png_destroy_write_struct(&png, &info);
+        fclose(fp);
+        std::cerr << "Error: Error during PNG encoding" << std::endl;
+        return false;
+    }
+
+    png_init_io(png, fp);
+    png_set_IHDR(png, info, width, height, 8, PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE,
+                 PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+    // the runs of one color make the left neighbor the only filter worth
+    // trying, and deflate time, not drawing, dominates at print sizes
+    png_set_filter(png, 0, PNG_FILTER_SUB);
+    png_set_compression_level(png, 3);
+    png_write_info(png, info);
+    for (int y0 = 0; y0 < height; y0 += CG_SCALE_BAND) {
+        int rows = std::min(CG_SCALE_BAND, height - y0);
+        #pragma omp parallel
+        {
+            std::vector<std::pair<int, size_t>> events;
+            std::vector<uint64_t> set((circles.size() + 63) / 64);
+            #pragma omp for schedule(dynamic, 4)
+            for (int k = 0; k < rows; ++k) {
+                scaledRow(circles, labels, set_labels, scale, width, y0 + k, events, set, &band[(size_t)k * width * 3]);
+            }
+        }
+        for (int k = 0; k < rows; ++k) png_write_row(png, &band[(size_t)k * width * 3]);
+    }
+    png_write_end(png, NULL);
+    png_destroy_write_struct(&png, &info);
+    fclose(fp);
+    std::cout << "Scaled image: " << width << "x" << height << std::endl;
+    return true;
+}
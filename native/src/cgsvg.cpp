@@ -0,0 +1,356 @@
+/**
+ * @file cgsvg.cpp
+ * @author Jupiter Westbard
+ * @date 10/18/2026
+ * @brief vector output of the circle arrangement for circlegen
+ */
+
+#include <iostream>
+#include <cstdio>
+#include <cmath>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+
+#include "tinyxml2.h"
+#include "circlegen.h"
+
+#define CG_SVG_SAMPLE_OFFSETS {0.75, 1.5, 3.0}  // pixels from an arc to the samples of its faces
+#define CG_SVG_GRID 64                          // samples per side when the arcs found no pixel of a face
+#define CG_SVG_ANGLE_EPSILON 1e-9               // crossings closer than this (radians) are one point
+
+struct darc_ { // one piece of a circle between neighboring crossings, angles increasing
+    size_t circle;
+    double t0;
+    double t1;
+}; typedef struct darc_ darc;
+
+struct dface_ { // the part of the plane inside exactly one set of circles
+    std::vector<uint64_t> set;                // one bit per circle
+    std::vector<std::pair<size_t, bool>> arcs; // arc and whether the face is inside its circle
+    bool found;                               // a sampled pixel was inside the face
+    uint32_t label;                           // the label of that pixel, which all pixels of the face share
+    std::unordered_map<uint32_t, int> near;   // labels of sampled pixels that missed it
+}; typedef struct dface_ dface;
+
+struct dsvgsethash_ {
+    size_t operator()(const std::vector<uint64_t> &set) const {
+        uint64_t h = 0x9E3779B97F4A7C15ULL;
+        for (uint64_t word : set) h = (h ^ word) * 0x100000001B3ULL;
+        return std::hash<uint64_t>()(h);
+    }
+};
+
+// the containment test of the fill, so the sampled pixels agree with the labels
+static bool pixelInside(int x, int y, const dcircle &circle) {
+    float cx = std::get<0>(circle);
+    float cy = std::get<1>(circle);
+    float r = std::get<2>(circle);
+    float px = static_cast<float>(x);
+    float py = static_cast<float>(y);
+    return std::sqrt((px - cx) * (px - cx) + (py - cy) * (py - cy)) < r;
+}
+
+// whether a pixel is inside exactly the circles of a set; most samples that
+// miss it already differ in one of the first few circles
+static bool pixelInSet(int x, int y, const std::vector<dcircle> &circles, const std::vector<uint64_t> &set) {
+    for (size_t i = 0; i < circles.size(); ++i) {
+        if (pixelInside(x, y, circles[i]) != (bool)(set[i / 64] >> i % 64 & 1)) return false;
+    }
+    return true;
+}
+
+// angles on circle a where circle b crosses it; none for disjoint, nested
+// or tangent circles, whose boundaries don't split each other
+static void crossings(const dcircle &a, const dcircle &b, std::vector<double> &angles) {
+    double dx = std::get<0>(b) - std::get<0>(a);
+    double dy = std::get<1>(b) - std::get<1>(a);
+    double ra = std::get<2>(a);
+    double rb = std::get<2>(b);
+    double d = std::sqrt(dx * dx + dy * dy);
+    if (d >= ra + rb || d <= std::abs(ra - rb)) return;
+    double along = (ra * ra - rb * rb + d * d) / (2.0 * d);
+    double cosine = along / ra;
+    if (!(cosine > -1.0 && cosine < 1.0)) return;
+    double base = std::atan2(dy, dx);
+    double spread = std::acos(cosine);
+    for (double t : {base - spread, base + spread}) {
+        angles.push_back(t < 0.0 ? t + 2.0 * M_PI : t);
+    }
+}
+
+static void arcPoint(const dcircle &circle, double t, double &x, double &y) {
+    x = std::get<0>(circle) + std::get<2>(circle) * std::cos(t);
+    y = std::get<1>(circle) + std::get<2>(circle) * std::sin(t);
+}
+
+// the boundary of a face as closed loops of svg arcs. Each arc is walked so
+// the face is on its left (increasing angle when inside the circle), so the
+// loops wind once around the face and zero times around its holes, and
+// joining each arc to the unused one starting nearest its end closes them
+static std::string facePath(const dface &face, const std::vector<darc> &arcs, const std::vector<dcircle> &circles) {
+    std::string d;
+    char command[96];
+    std::vector<bool> used(face.arcs.size(), false);
+    std::vector<std::pair<double, double>> starts(face.arcs.size());
+    for (size_t j = 0; j < face.arcs.size(); ++j) {
+        const darc &arc = arcs[face.arcs[j].first];
+        arcPoint(circles[arc.circle], face.arcs[j].second ? arc.t0 : arc.t1, starts[j].first, starts[j].second);
+    }
+    for (size_t first = 0; first < face.arcs.size(); ++first) {
+        if (used[first]) continue;
+        size_t k = first;
+        double start_x = 0.0, start_y = 0.0;
+        while (true) {
+            used[k] = true;
+            const darc &arc = arcs[face.arcs[k].first];
+            const dcircle &circle = circles[arc.circle];
+            bool forward = face.arcs[k].second;
+            double from = forward ? arc.t0 : arc.t1;
+            double to = forward ? arc.t1 : arc.t0;
+            double x, y;
+            if (k == first) {
+                start_x = starts[k].first;
+                start_y = starts[k].second;
+                snprintf(command, sizeof(command), "M%.2f %.2f", start_x, start_y);
+                d += command;
+            }
+            // svg can't draw a whole circle as one arc; split every arc in two
+            double r = std::get<2>(circle);
+            double mid = 0.5 * (from + to);
+            for (double t : {mid, to}) {
+                arcPoint(circle, t, x, y);
+                snprintf(command, sizeof(command), "A%.2f %.2f 0 0 %d %.2f %.2f", r, r, forward ? 1 : 0, x, y);
+                d += command;
+            }
+
+            size_t next = face.arcs.size();
+            double best = INFINITY;
+            for (size_t j = 0; j < face.arcs.size(); ++j) {
+                if (used[j]) continue;
+                double gap = (starts[j].first - x) * (starts[j].first - x) +
+                             (starts[j].second - y) * (starts[j].second - y);
+                if (gap < best) {
+                    best = gap;
+                    next = j;
+                }
+            }
+            double closing = (start_x - x) * (start_x - x) + (start_y - y) * (start_y - y);
+            if (next == face.arcs.size() || closing <= best) break;
+            k = next;
+        }
+        d += "Z";
+    }
+    return d;
+}
+
+// the fill gives every pixel of a set of circles the same label, so the first
+// sampled pixel inside the face decides it. Samples go just inside the face
+// along its arcs, closest first
+static void sampleArcs(dface &face, const std::vector<darc> &arcs, const std::vector<dcircle> &circles,
+                       const dlabelmap &labels) {
+    for (double offset : CG_SVG_SAMPLE_OFFSETS) {
+        for (const auto &side : face.arcs) {
+            const darc &arc = arcs[side.first];
+            const dcircle &circle = circles[arc.circle];
+            double r = std::get<2>(circle) + (side.second ? -offset : offset);
+            if (r <= 0.0) continue;
+            for (double fraction : {0.5, 0.25, 0.75}) {
+                double t = arc.t0 + fraction * (arc.t1 - arc.t0);
+                int x = (int)std::lround(std::get<0>(circle) + r * std::cos(t));
+                int y = (int)std::lround(std::get<1>(circle) + r * std::sin(t));
+                if (x < 0 || y < 0 || x >= labels.width || y >= labels.height) continue;
+                uint32_t label = labels.label[(size_t)y * labels.width + x];
+                if (!pixelInSet(x, y, circles, face.set)) {
+                    ++face.near[label];
+                    continue;
+                }
+                face.label = label;
+                face.found = true;
+                return;
+            }
+        }
+    }
+}
+
+// a grid over the part of the image a face's bounding box covers, for faces
+// whose samples along the arcs all fell off the image or on other faces
+static void sampleInterior(dface &face, const std::vector<darc> &arcs, const std::vector<dcircle> &circles,
+                           const dlabelmap &labels) {
+    double x0 = INFINITY, y0 = INFINITY, x1 = -INFINITY, y1 = -INFINITY;
+    for (const auto &side : face.arcs) {
+        const darc &arc = arcs[side.first];
+        for (int k = 0; k <= 16; ++k) {
+            double x, y;
+            arcPoint(circles[arc.circle], arc.t0 + k * (arc.t1 - arc.t0) / 16.0, x, y);
+            x0 = std::min(x0, x);
+            y0 = std::min(y0, y);
+            x1 = std::max(x1, x);
+            y1 = std::max(y1, y);
+        }
+    }
+    x0 = std::max(x0, 0.0);
+    y0 = std::max(y0, 0.0);
+    x1 = std::min(x1, labels.width - 1.0);
+    y1 = std::min(y1, labels.height - 1.0);
+    if (x0 > x1 || y0 > y1) return;
+
+    double step = std::max(1.0, std::max(x1 - x0, y1 - y0) / CG_SVG_GRID);
+    for (double y = std::ceil(y0); y <= y1; y += step) {
+        for (double x = std::ceil(x0); x <= x1; x += step) {
+            int px = (int)x;
+            int py = (int)y;
+            if (!pixelInSet(px, py, circles, face.set)) continue;
+            face.label = labels.label[(size_t)py * labels.width + px];
+            face.found = true;
+            return;
+        }
+    }
+}
+
+// faces no pixel landed in are thinner than a pixel: they take the label most
+// of their samples fell on, so they blend into their neighbors
+static bool faceLabel(const dface &face, uint32_t &label) {
+    if (face.found) {
+        label = face.label;
+        return true;
+    }
+    int best = 0;
+    for (const auto &vote : face.near) {
+        if (vote.second > best || (vote.second == best && vote.first < label)) {
+            best = vote.second;
+            label = vote.first;
+        }
+    }
+    return best > 0;
+}
+
+static std::string svgColor(const dpixel &color) {
+    char hex[8];
+    snprintf(hex, sizeof(hex), "#%02x%02x%02x", color.R & 0xff, color.G & 0xff, color.B & 0xff);
+    return hex;
+}
+
+bool saveVectorImage(const std::vector<dcircle> &circles, const dlabelmap &labels, const char *filename) {
+    // repeated circles split nothing; the first of them stands for all
+    std::vector<dcircle> unique;
+    for (const dcircle &circle : circles) {
+        if (!(std::get<2>(circle) > 0.0)) continue;
+        bool seen = false;
+        for (const dcircle &other : unique) seen = seen || equalCircles(circle, other, 1e-9);
+        if (!seen) unique.push_back(circle);
+    }
+
+    // split every circle into arcs at its crossings with the others
+    std::vector<darc> arcs;
+    for (size_t i = 0; i < unique.size(); ++i) {
+        std::vector<double> angles;
+        for (size_t j = 0; j < unique.size(); ++j) {
+            if (j != i) crossings(unique[i], unique[j], angles);
+        }
+        std::sort(angles.begin(), angles.end());
+        angles.erase(std::unique(angles.begin(), angles.end(),
+                                 [](double a, double b) { return b - a < CG_SVG_ANGLE_EPSILON; }),
+                     angles.end());
+        if (angles.empty()) {
+            arcs.push_back({i, 0.0, 2.0 * M_PI});
+            continue;
+        }
+        for (size_t k = 0; k < angles.size(); ++k) {
+            double next = k + 1 < angles.size() ? angles[k + 1] : angles[0] + 2.0 * M_PI;
+            arcs.push_back({i, angles[k], next});
+        }
+    }
+
+    // the faces on both sides of every arc: the circles containing its
+    // midpoint, with and without its own circle
+    std::vector<dface> faces;
+    std::unordered_map<std::vector<uint64_t>, size_t, dsvgsethash_> ids;
+    for (size_t a = 0; a < arcs.size(); ++a) {
+        const darc &arc = arcs[a];
+        double mx, my;
+        arcPoint(unique[arc.circle], 0.5 * (arc.t0 + arc.t1), mx, my);
+        std::vector<uint64_t> set((unique.size() + 63) / 64, 0);
+        for (size_t j = 0; j < unique.size(); ++j) {
+            if (j == arc.circle) continue;
+            double dx = mx - std::get<0>(unique[j]);
+            double dy = my - std::get<1>(unique[j]);
+            if (std::sqrt(dx * dx + dy * dy) < std::get<2>(unique[j])) set[j / 64] |= 1ULL << j % 64;
+        }
+        for (bool inside : {true, false}) {
+            if (inside) set[arc.circle / 64] |= 1ULL << arc.circle % 64;
+            else set[arc.circle / 64] &= ~(1ULL << arc.circle % 64);
+            auto found = ids.emplace(set, faces.size());
+            if (found.second) faces.push_back({set, {}, false, 0, {}});
+            faces[found.first->second].arcs.push_back(std::make_pair(a, inside));
+        }
+    }
+    std::vector<uint64_t> outside((unique.size() + 63) / 64, 0);
+    auto found = ids.emplace(outside, faces.size());
+    if (found.second) faces.push_back({outside, {}, false, 0, {}});
+    size_t background = found.first->second;
+
+    // color the faces from pixels sampled just off their arcs, then from a
+    // grid over the few the arcs missed
+    for (int corner = 0; corner < 4 && !faces[background].found; ++corner) {
+        int x = corner % 2 ? labels.width - 1 : 0;
+        int y = corner / 2 ? labels.height - 1 : 0;
+        if (!pixelInSet(x, y, unique, outside)) continue;
+        faces[background].label = labels.label[(size_t)y * labels.width + x];
+        faces[background].found = true;
+    }
+    #pragma omp parallel for schedule(dynamic, 16)
+    for (size_t f = 0; f < faces.size(); ++f) {
+        if (!faces[f].found) sampleArcs(faces[f], arcs, unique, labels);
+        if (!faces[f].found) sampleInterior(faces[f], arcs, unique, labels);
+    }
+
+    tinyxml2::XMLDocument doc;
+    doc.InsertEndChild(doc.NewDeclaration());
+    tinyxml2::XMLElement *svg = doc.NewElement("svg");
+    svg->SetAttribute("xmlns", "http://www.w3.org/2000/svg");
+    svg->SetAttribute("width", labels.width);
+    svg->SetAttribute("height", labels.height);
+    std::string box = "0 0 " + std::to_string(labels.width) + " " + std::to_string(labels.height);
+    svg->SetAttribute("viewBox", box.c_str());
+    doc.InsertEndChild(svg);
+
+    // faces outside every circle are the background, the rest are disjoint paths
+    uint32_t label = labels.label.empty() ? 0 : labels.label[0];
+    faceLabel(faces[background], label);
+    tinyxml2::XMLElement *rect = doc.NewElement("rect");
+    rect->SetAttribute("width", labels.width);
+    rect->SetAttribute("height", labels.height);
+    rect->SetAttribute("fill", labels.palette.empty() ? "#ffffff" : svgColor(labels.palette[label]).c_str());
+    svg->InsertEndChild(rect);
+    size_t drawn = 0;
+    for (size_t f = 0; f < faces.size(); ++f) {
+        if (f == background || !faceLabel(faces[f], label)) continue; // never on the image
+        tinyxml2::XMLElement *path = doc.NewElement("path");
+        path->SetAttribute("d", facePath(faces[f], arcs, unique).c_str());
+        path->SetAttribute("fill", svgColor(labels.palette[label]).c_str());
+        svg->InsertEndChild(path);
+        ++drawn;
+    }
+
+    // the same outlines saveImage draws, which also hide seams between faces
+    tinyxml2::XMLElement *outlines = doc.NewElement("g");
+    outlines->SetAttribute("fill", "none");
+    outlines->SetAttribute("stroke", "#1a1a1a");
+    outlines->SetAttribute("stroke-width", 1);
+    for (const dcircle &circle : unique) {
+        tinyxml2::XMLElement *outline = doc.NewElement("circle");
+        outline->SetAttribute("cx", std::get<0>(circle));
+        outline->SetAttribute("cy", std::get<1>(circle));
+        outline->SetAttribute("r", std::get<2>(circle));
+        outlines->InsertEndChild(outline);
+    }
+    svg->InsertEndChild(outlines);
+
+    if (doc.SaveFile(filename) != tinyxml2::XML_SUCCESS) {
+        std::cerr << "Error: Could not write SVG file " << filename << std::endl;
+        return false;
+    }
+    std::cout << "Vector image: " << arcs.size() << " arcs, " << drawn << " faces" << std::endl;
+    return true;
+}
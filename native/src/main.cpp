@@ -1,5 +1,9 @@
 #include <iostream>
 #include <fstream>
+#include <atomic>
+#include <csignal>
+#include <chrono>
+#include <string>
 
 #include "argparse.hpp"
 #include "gdcpp.h"
@@ -8,8 +12,47 @@
 
 struct CGArgs : public argparse::Args {
     std::string &img_path  = arg("src_path", "a positional string argument");
+    std::string &engine    = kwarg("engine", "circle search engine: descent | ransac | hough | batch").set_default("descent");
+    std::string &fitter    = kwarg("fitter", "circle refinement: gd | gdf | gdcpp | lm | dt").set_default("gd");
+    std::string &seeding   = kwarg("seeding", "initial guesses: random | normal | pair").set_default("random");
+    int &circles           = kwarg("circles", "number of circles to generate").set_default(6);
+    double &dedup          = kwarg("dedup", "skip descents reaching a circle already fitted within this many pixels, 0 disables").set_default(0.0);
+    int &rounds            = kwarg("rounds", "seeds fitted in parallel per round by the descent engine, 0 fits one at a time").set_default(0);
+    int &pyramid           = kwarg("pyramid", "search circles on a pyramid level at least this wide and refine them upwards, 0 disables").set_default(0);
+    double &accept_loss    = kwarg("accept-loss", "largest loss a descent fit may end with, 0 accepts any").set_default(0.0);
+    double &fill_sample    = kwarg("fill-sample", "fraction of the pixels fill colors are estimated from, 1 is exact").set_default(1.0);
+    double &budget         = kwarg("budget", "milliseconds for fitting and fill together, 0 for no limit").set_default(0.0);
+    std::string &labels    = kwarg("labels", "also write the fill's region labels and palette to this file").set_default("");
+    std::string &indexed   = kwarg("indexed", "also write the fill as an 8 bit indexed png to this file").set_default("");
+    std::string &svg       = kwarg("svg", "also write the fill as an svg of circle arcs to this file").set_default("");
+    std::string &scaled    = kwarg("scaled", "also write the output scaled by --scale to this file").set_default("");
+    double &scale          = kwarg("scale", "output pixels per working pixel for --scaled").set_default(4.0);
+    bool &progressive      = flag("progressive", "write output_<k>.png after every accepted circle");
+    bool &bench            = flag("bench", "benchmark the fitters on the sampled points and the fill keys, then exit");
 };
 
+// Ctrl-C stops the search and fill early instead of killing the run
+static std::atomic<bool> cancelled(false);
+
+static void cancelRun(int) {
+    cancelled.store(true);
+}
+
+// progressive mode: fill and save an image for every circle as it arrives
+static void saveProgress(const std::vector<dcircle> &circles, void *user) {
+    dfillmap *fill = (dfillmap *)user;
+    auto start = std::chrono::steady_clock::now();
+    addFillCircle(*fill, circles.back());
+    dpixmap qpm = renderFill(*fill);
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    std::string filename = "output_" + std::to_string(circles.size()) + ".png";
+    std::vector<dcircle> drawn = circles;
+    saveImage(qpm, nullptr, drawn, filename.c_str());
+    std::cout << "Saved '" << filename << "' (fill " << ms << " ms)." << std::endl;
+    delete[] qpm.data;
+}
+
 int main(int argc, char *argv[]) {
     auto args = argparse::parse<CGArgs>(argc, argv);
 
@@ -36,15 +79,129 @@ int main(int argc, char *argv[]) {
     std::cout << "Sampling points..." << std::endl;
     dpointlist points = samplePoints(filtered, 300, 0.75);
 
+    if (args.bench) {
+        benchmarkFitters(points, &pm, 500);
+        benchmarkFill(pm);
+        delete[] pm.data;
+        delete[] filtered.data;
+        return 0;
+    }
+
+    cgparams params;
+    if (args.engine == "ransac") {
+        params.engine = CG_ENGINE_RANSAC;
+    }
+    else if (args.engine == "hough") {
+        params.engine = CG_ENGINE_HOUGH;
+    }
+    else if (args.engine == "batch") {
+        params.engine = CG_ENGINE_BATCH;
+    }
+    else if (args.engine != "descent") {
+        std::cerr << "Error: unknown engine '" << args.engine << "'" << std::endl;
+        return 1;
+    }
+    if (args.fitter == "lm") {
+        params.fitter = CG_FIT_LM;
+    }
+    else if (args.fitter == "gdf") {
+        params.fitter = CG_FIT_DESCENT_FLOAT;
+    }
+    else if (args.fitter == "gdcpp") {
+        params.fitter = CG_FIT_GDCPP;
+    }
+    else if (args.fitter == "dt") {
+        params.fitter = CG_FIT_DISTANCE;
+    }
+    else if (args.fitter != "gd") {
+        std::cerr << "Error: unknown fitter '" << args.fitter << "'" << std::endl;
+        return 1;
+    }
+    if (args.seeding == "normal") {
+        params.seeding = CG_SEED_NORMAL;
+    }
+    else if (args.seeding == "pair") {
+        params.seeding = CG_SEED_PAIR;
+    }
+    else if (args.seeding != "random") {
+        std::cerr << "Error: unknown seeding '" << args.seeding << "'" << std::endl;
+        return 1;
+    }
+    params.acceptLoss = args.accept_loss;
+    params.dedupTolerance = args.dedup;
+    params.roundSize = args.rounds;
+    params.pyramidWidth = args.pyramid;
+
+    // the budget starts with the search and also covers the fill
+    cgdeadline deadline = makeDeadline(args.budget / 1000.0, &cancelled);
+    params.deadline = &deadline;
+    std::signal(SIGINT, cancelRun);
+
+    dfillmap fill = {};
+    if (args.progressive) {
+        fill = beginFill(pm);
+        params.progress = saveProgress;
+        params.progressData = &fill;
+    }
+
     std::cout << "\nGenerating circles..." << std::endl;
-    std::vector<dcircle> circles = generateCircles(points, &pm, 6);
+    cgstats stats;
+    std::vector<dcircle> circles = generateCircles(points, &pm, args.circles, params, &stats);
+    std::cout << "Objective evaluations: " << stats.evaluations
+              << ", point tests: " << stats.pointTests << std::endl;
+    if (stats.fits > 0) {
+        std::cout << "Fits: " << stats.fits
+                  << ", iterations/fit: " << (double)stats.iterations / stats.fits
+                  << ", us/fit: " << 1e6 * stats.fitSeconds / stats.fits
+                  << ", mean loss: " << stats.lossSum / stats.fits << std::endl;
+        std::cout << "Aborted fits: " << stats.fitsAborted
+                  << ", completed: " << stats.fits - stats.fitsAborted
+                  << ", accepted: " << stats.fitsAccepted
+                  << (stats.rateStopped ? " (stopped, acceptance rate too low)" : "") << std::endl;
+        if (stats.coarseFits > 0) {
+            std::cout << "Pyramid: " << stats.coarseFits << " coarse fits in " << 1e3 * stats.coarseSeconds
+                      << " ms, " << stats.fits - stats.coarseFits << " full resolution fits" << std::endl;
+        }
+        if (stats.rounds > 0) {
+            std::cout << "Rounds: " << stats.rounds << std::endl;
+        }
+        if (stats.cacheLookups > 0) {
+            std::cout << "Dedup cache: " << stats.cacheHits << " of " << stats.fits << " fits stopped on a known circle ("
+                      << 100.0 * stats.cacheHits / stats.fits << "%), " << stats.cacheLookups << " lookups" << std::endl;
+        }
+    }
+
+    if (stats.truncated) {
+        std::cout << "Out of time: keeping " << circles.size() << " circles" << std::endl;
+    }
 
     std::cout << "\nGenerating fill colors..." << std::endl;
-    dpixmap qpm = quantizeColors(pm, circles);
+    bool fill_truncated = false;
+    // a progressive run already holds the fill of every circle; its last frame is the result
+    bool filled = args.progressive && fill.circles == circles;
+    dlabelmap labels = filled ? fillLabels(fill)
+                              : labelColors(pm, circles, &deadline, &fill_truncated, args.fill_sample);
+    if (fill_truncated) {
+        std::cout << "Out of time: fill colors use per channel medians" << std::endl;
+    }
+    std::signal(SIGINT, SIG_DFL);
+    dpixmap qpm = renderLabels(labels);
 
     std::cout << "\nSaving image..." << std::endl;
     saveImage(qpm, &points, circles);
     std::cout << "Saved to 'output.png'." << std::endl;
+    if (!args.labels.empty() && saveLabelMap(labels, args.labels.c_str())) {
+        std::cout << "Saved " << labels.palette.size() << " regions to '" << args.labels << "'." << std::endl;
+    }
+    if (!args.indexed.empty() && saveIndexedImage(labels, args.indexed.c_str())) {
+        std::cout << "Saved to '" << args.indexed << "'." << std::endl;
+    }
+    if (!args.svg.empty() && saveVectorImage(circles, labels, args.svg.c_str())) {
+        std::cout << "Saved to '" << args.svg << "'." << std::endl;
+    }
+    if (!args.scaled.empty() && saveScaledImage(circles, labels, args.scale, args.scaled.c_str())) {
+        std::cout << "Saved to '" << args.scaled << "'." << std::endl;
+    }
 
     delete[] pm.data;
     delete[] filtered.data;
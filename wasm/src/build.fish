@@ -1,3 +1,6 @@
+# The committed ../circlegen.{js,wasm} predate the chunked fill keys and
+# only key 32 circles. index.html stays capped at 32 until they are
+# rebuilt here and committed together with a higher page limit.
 rm ../circlegen*
 
 source /home/jupiter/emsdk/emsdk_env.fish
@@ -18,146 +18,229 @@
 #define M_PI 3.14159265f
 #endif
 
-struct dpixelidx { // pixel with index
-    uint8_t rgb[3];
-    int idx;
-}; typedef struct dpixelxy dpixelxy;
-
-struct overlapgroup_ {
-    std::unordered_map<uint64_t, std::vector<dpixelidx>> table;
-    std::vector<uint64_t> keys;
-}; typedef struct overlapgroup_ overlapgroup;
-
-dpixmap quantizeColors(const dpixmap &pm, std::vector<dcircle> &circles, bool drawLines) {
-    overlapgroup ogroup = {std::unordered_map<uint64_t, std::vector<dpixelidx>>(), std::vector<uint64_t>()};
-
-    for (int y = 0; y < pm.height; ++y) {
-        for (int x = 0; x < pm.width; ++x) {
-            int pixel_idx = y * pm.width + x;  // Linear pixel index
-            int rgb_idx = pixel_idx * 3;       // RGB byte index
-            uint8_t r = pm.data[rgb_idx];
-            uint8_t g = pm.data[rgb_idx + 1];
-            uint8_t b = pm.data[rgb_idx + 2];
-
-            // a pixel's hash key is a 64 bit field with each bit representing containment in a circle.
-            uint64_t key = 0;
-            for (size_t i = 0; i < circles.size(); ++i) {
-                float px = static_cast<float>(x);
-                float py = static_cast<float>(y);
-                float cx = std::get<0>(circles[i]);
-                float cy = std::get<1>(circles[i]);
-                float cr = std::get<2>(circles[i]);
-                float dist = std::sqrt((px - cx) * (px - cx) + (py - cy) * (py - cy));
-                if (dist < cr) {
-                    key |= 1U << i;
+struct dchannels_ { // channel histograms of one fill section
+    uint32_t count;
+    uint32_t hist[3][256];
+}; typedef struct dchannels_ dchannels;
+
+struct dlabels_ { // dense region id of every pixel
+    std::vector<uint32_t> label;
+    size_t count;
+}; typedef struct dlabels_ dlabels;
+
+// black anti-aliased outline of every circle, drawn over res
+static void drawOutlines(dpixmap &res, const std::vector<dcircle> &circles) {
+    for (size_t i = 0; i < circles.size(); ++i) {
+        float cx = std::get<0>(circles[i]);
+        float cy = std::get<1>(circles[i]);
+        float cr = std::get<2>(circles[i]);
+        // distance field for anti-aliasing
+        int min_x = static_cast<int>(cx - cr - 2);
+        int max_x = static_cast<int>(cx + cr + 2);
+        int min_y = static_cast<int>(cy - cr - 2);
+        int max_y = static_cast<int>(cy + cr + 2);
+        // Clamp to image bounds
+        min_x = std::max(0, min_x);
+        max_x = std::min(res.width - 1, max_x);
+        min_y = std::max(0, min_y);
+        max_y = std::min(res.height - 1, max_y);
+        for (int y = min_y; y <= max_y; ++y) {
+            for (int x = min_x; x <= max_x; ++x) {
+                float dist = std::sqrt((x - cx) * (x - cx) + (y - cy) * (y - cy));
+                // Check if pixel is within the thick outline area (cr-1.5 to cr+1.5)
+                float edge_dist = std::abs(dist - cr);
+                if (edge_dist <= 1.5f) {
+                    // Calculate anti-aliasing factor
+                    float alpha = 1.0f - std::max(0.0f, edge_dist - 0.5f);
+                    
+                    int rgb_idx = (y * res.width + x) * 3;
+                    
+                    // Get current pixel color
+                    uint8_t current_r = res.data[rgb_idx];
+                    uint8_t current_g = res.data[rgb_idx + 1];
+                    uint8_t current_b = res.data[rgb_idx + 2];
+                    
+                    // Blend with black based on alpha
+                    res.data[rgb_idx] = static_cast<uint8_t>(current_r * (1.0f - alpha));
+                    res.data[rgb_idx + 1] = static_cast<uint8_t>(current_g * (1.0f - alpha));
+                    res.data[rgb_idx + 2] = static_cast<uint8_t>(current_b * (1.0f - alpha));
                 }
             }
-
-            // create the new dpixel and add it to the hash table
-            dpixelidx pixel = {{r, g, b}, pixel_idx};
-            if (ogroup.table.find(key) == ogroup.table.end()) { // group not found
-                ogroup.keys.push_back(key);
-                ogroup.table[key] = std::vector<dpixelidx>();
-            }
-            ogroup.table[key].push_back(pixel);
         }
     }
+}
+
+// the per pixel containment test every fill applies
+static bool insideCircle(int x, int y, float cx, float cy, float cr) {
+    float px = static_cast<float>(x);
+    float py = static_cast<float>(y);
+    float dist = std::sqrt((px - cx) * (px - cx) + (py - cy) * (py - cy));
+    return dist < cr;
+}
+
+// pixels of row y inside the circle as the half open span [x0, x1), clipped
+// to the row. The chord half width gives the span; its ends are then moved
+// by the exact test above, so it holds the same pixels the test accepts
+static bool circleSpan(const dcircle &circle, int y, int width, int &x0, int &x1) {
+    float cx = std::get<0>(circle);
+    float cy = std::get<1>(circle);
+    float cr = std::get<2>(circle);
+    float dy = static_cast<float>(y) - cy;
+    float half = std::sqrt(std::max(0.0f, cr * cr - dy * dy));
+
+    int lo = static_cast<int>(std::ceil(cx - half));
+    int hi = static_cast<int>(std::floor(cx + half));
+    if (lo > hi) { // chord narrower than a pixel: test the two pixels around it
+        lo = static_cast<int>(std::floor(cx));
+        hi = lo + 1;
+    }
+    while (lo <= hi && !insideCircle(lo, y, cx, cy, cr)) ++lo;
+    while (hi >= lo && !insideCircle(hi, y, cx, cy, cr)) --hi;
+    if (lo > hi) return false;
+    while (insideCircle(lo - 1, y, cx, cy, cr)) --lo;
+    while (insideCircle(hi + 1, y, cx, cy, cr)) ++hi;
+
+    x0 = std::max(0, lo);
+    x1 = std::min(width, hi + 1);
+    return x0 < x1;
+}
 
-    std::cout << "Found " << ogroup.keys.size() << " fill sections." << std::endl;
-
-    for (auto &key : ogroup.keys) {
-        std::vector<dpixelidx> &pixels = ogroup.table[key];
-
-        // find the dominant channel (the r, g, or b channel with the highest range)
-        int rmin = 255, rmax = 0;
-        int gmin = 255, gmax = 0;
-        int bmin = 255, bmax = 0;
-        for (auto &pixel : pixels) {
-            if (pixel.rgb[0] < rmin) rmin = pixel.rgb[0];
-            if (pixel.rgb[0] > rmax) rmax = pixel.rgb[0];
-            if (pixel.rgb[1] < gmin) gmin = pixel.rgb[1];
-            if (pixel.rgb[1] > gmax) gmax = pixel.rgb[1];
-            if (pixel.rgb[2] < bmin) bmin = pixel.rgb[2];
-            if (pixel.rgb[2] > bmax) bmax = pixel.rgb[2];
+// a pixel's key is a field of 8 * sizeof(Key) bits, bit i - first representing
+// containment in circles[i]. each circle sets its bit along one span per row,
+// so this is O(pixels + spans)
+template<typename Key>
+static std::vector<Key> circleKeys(const dpixmap &pm, const std::vector<dcircle> &circles, size_t first) {
+    std::vector<Key> keys((size_t)pm.width * pm.height, 0);
+    size_t last = std::min(circles.size(), first + 8 * sizeof(Key));
+    for (size_t i = first; i < last; ++i) {
+        float cy = std::get<1>(circles[i]);
+        float cr = std::get<2>(circles[i]);
+        int min_y = std::max(0, static_cast<int>(std::floor(cy - cr)));
+        int max_y = std::min(pm.height - 1, static_cast<int>(std::ceil(cy + cr)));
+        Key bit = static_cast<Key>(1) << (i - first);
+        for (int y = min_y; y <= max_y; ++y) {
+            int x0, x1;
+            if (!circleSpan(circles[i], y, pm.width, x0, x1)) continue;
+            Key *row = &keys[y * pm.width];
+            for (int x = x0; x < x1; ++x) row[x] |= bit;
         }
-        int rrange = rmax - rmin;
-        int grange = gmax - gmin;
-        int brange = bmax - bmin;
-        int dominant = 0;
-        if (grange > rrange) dominant = 1;
-        if (brange > rrange && brange > grange) dominant = 2;
-
-        // sort pixels by dominant channel
-        std::sort(pixels.begin(), pixels.end(), [dominant](const dpixelidx &a, const dpixelidx &b) {
-            return a.rgb[dominant] < b.rgb[dominant];
-        });
-
-        // get median pixel (middle pixel in sorted list)
-        dpixelidx median = pixels[pixels.size() / 2];
-
-        // set all pixels to median pixel
-        for (auto &pixel : pixels) {
-            pixel.rgb[0] = median.rgb[0];
-            pixel.rgb[1] = median.rgb[1];
-            pixel.rgb[2] = median.rgb[2];
+    }
+    return keys;
+}
+
+template<typename Key>
+struct dsplithash_ {
+    size_t operator()(const std::pair<uint32_t, Key> &split) const {
+        return std::hash<uint64_t>()((static_cast<uint64_t>(split.second) * 0x9E3779B97F4A7C15ULL) ^ split.first);
+    }
+};
+
+// split every region by one chunk of keys: pixels sharing a region and a key
+// get the same new dense id, in order of first appearance. Neighboring pixels
+// mostly share both, so the previous pixel's pair is checked before the table
+template<typename Key>
+static void splitRegions(dlabels &labels, const std::vector<Key> &keys) {
+    std::unordered_map<std::pair<uint32_t, Key>, uint32_t, dsplithash_<Key>> ids;
+    std::pair<uint32_t, Key> last_split(0, 0);
+    uint32_t last_id = 0;
+    for (size_t pixel_idx = 0; pixel_idx < keys.size(); ++pixel_idx) {
+        std::pair<uint32_t, Key> split(labels.label[pixel_idx], keys[pixel_idx]);
+        if (pixel_idx == 0 || split != last_split) {
+            last_id = ids.emplace(split, static_cast<uint32_t>(ids.size())).first->second;
+            last_split = split;
         }
+        labels.label[pixel_idx] = last_id;
     }
+    labels.count = ids.size();
+}
 
-    // create the new dpixmap
+// dense region ids of the overlap sections, splitting by 8 * sizeof(Key)
+// circles per pass. The key width is a compile time choice: up to 32 circles
+// are one pass over 32 bit keys, and more circles only add passes
+template<typename Key>
+static dlabels labelRegions(const dpixmap &pm, const std::vector<dcircle> &circles) {
+    size_t pixels = (size_t)pm.width * pm.height;
+    dlabels labels = {std::vector<uint32_t>(pixels, 0), pixels > 0 ? 1U : 0U};
+    for (size_t first = 0; first < circles.size(); first += 8 * sizeof(Key)) {
+        splitRegions(labels, circleKeys<Key>(pm, circles, first));
+    }
+    return labels;
+}
+
+// the dominant channel (the one with the highest range) of count pixels and
+// its median: the value pixels[count / 2] has after sorting by that channel,
+// found by walking the cumulative counts in O(256)
+static int medianValue(const uint32_t (&hist)[3][256], uint32_t count, int *dominant) {
+    int range[3];
+    for (int c = 0; c < 3; ++c) {
+        int lo = 0, hi = 255;
+        while (hist[c][lo] == 0) ++lo;
+        while (hist[c][hi] == 0) --hi;
+        range[c] = hi - lo;
+    }
+    *dominant = 0;
+    if (range[1] > range[0]) *dominant = 1;
+    if (range[2] > range[0] && range[2] > range[1]) *dominant = 2;
+
+    uint32_t rank = count / 2;
+    uint32_t seen = 0;
+    int median = 0;
+    while (seen + hist[*dominant][median] <= rank) seen += hist[*dominant][median++];
+    return median;
+}
+
+dpixmap quantizeColors(const dpixmap &pm, std::vector<dcircle> &circles, bool drawLines) {
+    dlabels labels = circles.size() <= 32 ? labelRegions<uint32_t>(pm, circles) : labelRegions<uint64_t>(pm, circles);
+    size_t count = labels.count;
+    std::cout << "Found " << count << " fill sections." << std::endl;
+
+    // second pass: channel histograms of every region
+    std::vector<dchannels> channels(count, dchannels());
+    for (int pixel_idx = 0; pixel_idx < pm.width * pm.height; ++pixel_idx) {
+        const uint8_t *rgb = &pm.data[pixel_idx * 3];
+        dchannels &region = channels[labels.label[pixel_idx]];
+        ++region.count;
+        ++region.hist[0][rgb[0]];
+        ++region.hist[1][rgb[1]];
+        ++region.hist[2][rgb[2]];
+    }
+
+    std::vector<int> dominant(count), median(count);
+    for (size_t k = 0; k < count; ++k) median[k] = medianValue(channels[k].hist, channels[k].count, &dominant[k]);
+
+    // third pass: the other two channels are the mean over the pixels at the
+    // dominant median
+    std::vector<uint64_t> sums(count * 2, 0);
+    for (int pixel_idx = 0; pixel_idx < pm.width * pm.height; ++pixel_idx) {
+        const uint8_t *rgb = &pm.data[pixel_idx * 3];
+        uint32_t id = labels.label[pixel_idx];
+        int d = dominant[id];
+        if (rgb[d] != median[id]) continue;
+        sums[id * 2] += rgb[(d + 1) % 3];
+        sums[id * 2 + 1] += rgb[(d + 2) % 3];
+    }
+
+    std::vector<uint8_t> colors(count * 3);
+    for (size_t k = 0; k < count; ++k) {
+        int d = dominant[k];
+        uint64_t n = channels[k].hist[d][median[k]];
+        colors[k * 3 + d] = median[k];
+        colors[k * 3 + (d + 1) % 3] = (sums[k * 2] + n / 2) / n;
+        colors[k * 3 + (d + 2) % 3] = (sums[k * 2 + 1] + n / 2) / n;
+    }
+
+    // create the new dpixmap, one linear pass over the labels
     dpixmap res;
     res.width = pm.width;
     res.height = pm.height;
     res.data = new uint8_t[pm.width * pm.height * 3];
-
-    for (auto &key : ogroup.keys) {
-        for (auto &pixel : ogroup.table[key]) {
-            // Convert linear pixel index to RGB byte index
-            int rgb_idx = pixel.idx * 3;
-            res.data[rgb_idx] = pixel.rgb[0];
-            res.data[rgb_idx + 1] = pixel.rgb[1];
-            res.data[rgb_idx + 2] = pixel.rgb[2];
-        }
+    for (int pixel_idx = 0; pixel_idx < pm.width * pm.height; ++pixel_idx) {
+        const uint8_t *rgb = &colors[labels.label[pixel_idx] * 3];
+        res.data[pixel_idx * 3] = rgb[0];
+        res.data[pixel_idx * 3 + 1] = rgb[1];
+        res.data[pixel_idx * 3 + 2] = rgb[2];
     }
     // draw black outlines if requested
-    if (drawLines) {
-        for (size_t i = 0; i < circles.size(); ++i) {
-            float cx = std::get<0>(circles[i]);
-            float cy = std::get<1>(circles[i]);
-            float cr = std::get<2>(circles[i]);
-            // distance field for anti-aliasing
-            int min_x = static_cast<int>(cx - cr - 2);
-            int max_x = static_cast<int>(cx + cr + 2);
-            int min_y = static_cast<int>(cy - cr - 2);
-            int max_y = static_cast<int>(cy + cr + 2);
-            // Clamp to image bounds
-            min_x = std::max(0, min_x);
-            max_x = std::min(res.width - 1, max_x);
-            min_y = std::max(0, min_y);
-            max_y = std::min(res.height - 1, max_y);
-            for (int y = min_y; y <= max_y; ++y) {
-                for (int x = min_x; x <= max_x; ++x) {
-                    float dist = std::sqrt((x - cx) * (x - cx) + (y - cy) * (y - cy));
-                    // Check if pixel is within the thick outline area (cr-1.5 to cr+1.5)
-                    float edge_dist = std::abs(dist - cr);
-                    if (edge_dist <= 1.5f) {
-                        // Calculate anti-aliasing factor
-                        float alpha = 1.0f - std::max(0.0f, edge_dist - 0.5f);
-                        
-                        int rgb_idx = (y * res.width + x) * 3;
-                        
-                        // Get current pixel color
-                        uint8_t current_r = res.data[rgb_idx];
-                        uint8_t current_g = res.data[rgb_idx + 1];
-                        uint8_t current_b = res.data[rgb_idx + 2];
-                        
-                        // Blend with black based on alpha
-                        res.data[rgb_idx] = static_cast<uint8_t>(current_r * (1.0f - alpha));
-                        res.data[rgb_idx + 1] = static_cast<uint8_t>(current_g * (1.0f - alpha));
-                        res.data[rgb_idx + 2] = static_cast<uint8_t>(current_b * (1.0f - alpha));
-                    }
-                }
-            }
-        }
-    }
+    if (drawLines) drawOutlines(res, circles);
     return res;
 }